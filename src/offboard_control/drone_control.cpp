@@ -8,14 +8,31 @@
 #include <tf2_ros/static_transform_broadcaster.h>
 #include <tf2_ros/transform_broadcaster.h>
 
+static Eigen::Isometry3d toEigen(const geometry_msgs::Transform &t)
+{
+  Eigen::Isometry3d T = Eigen::Isometry3d::Identity();
+  T.translation() = Eigen::Vector3d(t.translation.x, t.translation.y, t.translation.z);
+  T.linear() = Eigen::Quaterniond(t.rotation.w, t.rotation.x, t.rotation.y, t.rotation.z).toRotationMatrix();
+  return T;
+}
+
 DroneControl::DroneControl(ROSClient *ros_client)
 {
+  ros::param::param<int>("~marker_id", marker_id_, -1);
+
   this->ros_client_ = ros_client;
   this->ros_client_->init(this);
 
   // The setpoint publishing rate MUST be faster than 2Hz
   this->rate_ = new ros::Rate(ROS_RATE);
 
+  this->setpoint_streamer_ = new SetpointStreamer(ros_client_->setpoint_raw_pub_);
+
+  // An empty trace file name disables the binary trace, the summary is still printed
+  std::string trace_file;
+  ros::param::param<std::string>("~trace_file", trace_file, "offboard_control_trace.bin");
+  this->profiler_ = new MissionProfiler(trace_file);
+
   static tf2_ros::TransformListener tfListener(tfBuffer_);
 }
 
@@ -59,6 +76,7 @@ void DroneControl::marker_position_cb(const geometry_msgs::PoseArray::ConstPtr &
     transformStamped_.transform.rotation = tf::createQuaternionMsgFromYaw(rad);
   }
   br.sendTransform(transformStamped_);
+  Eigen::Isometry3d T_drone_marker = toEigen(transformStamped_.transform);
 
   double target_distance = marker_position_.poses[0].position.z/4; // Target distance is proportional to horizontal distance
   if(target_distance < 1) target_distance = 1; // Minimum of 1 meter
@@ -78,32 +96,58 @@ void DroneControl::marker_position_cb(const geometry_msgs::PoseArray::ConstPtr &
   transformStamped_.transform.rotation.z = 0;
   transformStamped_.transform.rotation.w = 1;
   br.sendTransform(transformStamped_);
+  Eigen::Isometry3d T_marker_target = toEigen(transformStamped_.transform);
 
-  if(approaching_)
+  // Filter the marker in the world frame, the target keeps its current offset from the marker.
+  // The drone pose is taken at the image stamp, the marker and target frames just sent
+  // are composed here since the listener would only return them a frame later.
+  try
   {
-    try
-    {
-      transformStamped_ = tfBuffer_.lookupTransform("world", "target_position", ros::Time(0));
+    geometry_msgs::TransformStamped drone_tf = tfBuffer_.lookupTransform("world", "drone", marker_position_.header.stamp,
+                                                                         ros::Duration(0.05));
 
-      endpoint_pos_ENU_.pose.position.x = transformStamped_.transform.translation.x;
-      endpoint_pos_ENU_.pose.position.y = transformStamped_.transform.translation.y;
-      endpoint_pos_ENU_.pose.position.z = transformStamped_.transform.translation.z;
-      double yaw = getYaw(transformStamped_.transform.rotation);
-      endpoint_pos_ENU_.pose.orientation = tf::createQuaternionMsgFromYaw(yaw);
+    Eigen::Isometry3d T_world_marker = toEigen(drone_tf.transform) * T_drone_marker;
+    Eigen::Isometry3d T_world_target = T_world_marker * T_marker_target;
 
-      endpoint_active_ = true;
+    Eigen::Vector3d marker = T_world_marker.translation();
+    Eigen::Vector3d target = T_world_target.translation();
 
-      if(cnt % 66 == 0)
-      {
-        ROS_INFO("Endpoint position: E: %f, N: %f, U: %f, yaw: %f", transformStamped_.transform.translation.x,
-                transformStamped_.transform.translation.y, transformStamped_.transform.translation.z, yaw);
-      }
-      cnt++;
-    }
-    catch (tf2::TransformException &ex)
+    if(!marker_filter_.update(marker, marker_position_.poses[0].position.z, marker_position_.header.stamp))
+      ROS_WARN_THROTTLE(1, "Marker detection rejected as outlier");
+
+    endpoint_offset_ = target - marker;
+    endpoint_yaw_ = atan2(T_world_target.linear()(1, 0), T_world_target.linear()(0, 0));
+  }
+  catch (tf2::TransformException &ex)
+  {
+    ROS_ERROR("%s",ex.what());
+  }
+
+  if(approaching_ && marker_filter_.initialized())
+  {
+    predictEndpoint();
+    endpoint_active_ = true;
+
+    if(cnt % 66 == 0)
     {
-      ROS_ERROR("%s",ex.what());
+      ROS_INFO("Endpoint position: E: %f, N: %f, U: %f, yaw: %f", endpoint_pos_ENU_.pose.position.x,
+              endpoint_pos_ENU_.pose.position.y, endpoint_pos_ENU_.pose.position.z, endpoint_yaw_);
     }
+    cnt++;
+  }
+}
+
+void DroneControl::marker_ids_cb(const geometry_msgs::PoseArray::ConstPtr &poses, const whycon::MarkerIds::ConstPtr &ids)
+{
+  for(size_t i = 0; i < poses->poses.size() && i < ids->ids.size(); ++i)
+  {
+    if(ids->ids[i] != marker_id_) continue;
+
+    geometry_msgs::PoseArray::Ptr marker(new geometry_msgs::PoseArray);
+    marker->header = poses->header;
+    marker->poses.push_back(poses->poses[i]);
+    marker_position_cb(marker);
+    return;
   }
 }
 
@@ -164,10 +208,22 @@ void DroneControl::global_position_cb(const sensor_msgs::NavSatFix::ConstPtr &ms
   }
 }
 
-void DroneControl::setpoint_position_cb(const geometry_msgs::PoseStamped::ConstPtr &msg)
+void DroneControl::trajectory_cb(const trajectory_planner::BSplineTrajectory::ConstPtr &msg)
 {
   if(approaching_ && !endpoint_active_) return;
-  else setpoint_pos_ENU_ = *msg;
+
+  SetpointStreamer::Spline::Ptr spline = SetpointStreamer::makeSpline(*msg);
+  if(!spline) return;
+
+  // The blocking behaviours keep the start of the latest trajectory as reference
+  Eigen::Vector3d p = spline->evaluate(0, 0);
+  setpoint_pos_ENU_.header = msg->header;
+  setpoint_pos_ENU_.pose.position.x = p[0];
+  setpoint_pos_ENU_.pose.position.y = p[1];
+  setpoint_pos_ENU_.pose.position.z = p[2];
+  setpoint_pos_ENU_.pose.orientation = tf::createQuaternionMsgFromYaw(spline->hasYaw() ? spline->evaluateYaw(0, 0) : msg->yaw);
+
+  if(setpoint_streamer_->isRunning()) setpoint_streamer_->setTrajectory(msg->header.stamp, spline, msg->yaw);
 }
 
 void DroneControl::svo_position_cb(const geometry_msgs::PoseWithCovarianceStamped::ConstPtr &msg)
@@ -252,6 +308,8 @@ void DroneControl::svo_position_cb(const geometry_msgs::PoseWithCovarianceStampe
 
 void DroneControl::offboardMode()
 {
+  MissionProfiler::Span span(profiler_, "offboardMode");
+
   // Wait for FCU connection
   while(ros::ok() && current_state_.connected)
   {
@@ -271,6 +329,7 @@ void DroneControl::offboardMode()
 
   last_svo_estimate_ = ros::Time::now(); //TODO this is error prone
 
+  profiler_->dataAge("local_position", local_position_.header.stamp);
   if(ros::Time::now() - local_position_.header.stamp < ros::Duration(1.0))
   {
     ROS_INFO("Local_position available");
@@ -291,10 +350,12 @@ void DroneControl::offboardMode()
 
   setpoint_pos_ENU_ = gps_init_pos_ = local_position_;
 
+  if(USE_SETPOINT_STREAMER) setpoint_streamer_->start(setpoint_pos_ENU_);
+
   // Send a few setpoints before starting, otherwise px4 will not switch to OFFBOARD mode
   for(int i = 20; ros::ok() && i > 0; --i)
   {
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -329,7 +390,7 @@ void DroneControl::offboardMode()
         last_request_ = ros::Time::now();
       }
     }
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -394,6 +455,8 @@ void DroneControl::collisionAvoidOn()
 
 void DroneControl::takeOff()
 {
+  MissionProfiler::Span span(profiler_, "takeOff");
+
   ROS_INFO("Taking off. Current position: E: %f, N: %f, U: %f", local_position_.pose.position.x,
            local_position_.pose.position.y, local_position_.pose.position.z);
 
@@ -404,7 +467,7 @@ void DroneControl::takeOff()
   ROS_INFO("Taking off");
   for(int i = 0; ros::ok() && i < 10 * ROS_RATE; ++i)
   {
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -414,6 +477,8 @@ void DroneControl::takeOff()
 
 void DroneControl::initVIO()
 {
+  MissionProfiler::Span span(profiler_, "initVIO");
+
   vioOn();
 
   //Translational movement to start odometry
@@ -426,7 +491,7 @@ void DroneControl::initVIO()
     {
       setpoint_pos_ENU_.pose.position.x += INIT_FLIGHT_LENGTH/INIT_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -435,7 +500,7 @@ void DroneControl::initVIO()
     {
       setpoint_pos_ENU_.pose.position.x -= INIT_FLIGHT_LENGTH/INIT_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -454,6 +519,8 @@ void DroneControl::initVIO()
 
 void DroneControl::testFlightHorizontal()
 {
+  MissionProfiler::Span span(profiler_, "testFlightHorizontal");
+
   ROS_INFO("Horizontal test flight");
 
   for(int j = 0; ros::ok() && j < TEST_FLIGHT_REPEAT; ++j)
@@ -462,7 +529,7 @@ void DroneControl::testFlightHorizontal()
     {
       setpoint_pos_ENU_.pose.position.x += TEST_FLIGHT_LENGTH/TEST_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -470,7 +537,7 @@ void DroneControl::testFlightHorizontal()
     {
       setpoint_pos_ENU_.pose.position.y += TEST_FLIGHT_LENGTH/TEST_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -478,7 +545,7 @@ void DroneControl::testFlightHorizontal()
     {
       setpoint_pos_ENU_.pose.position.x -= TEST_FLIGHT_LENGTH/TEST_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -486,7 +553,7 @@ void DroneControl::testFlightHorizontal()
     {
       setpoint_pos_ENU_.pose.position.y -= TEST_FLIGHT_LENGTH/TEST_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -495,6 +562,8 @@ void DroneControl::testFlightHorizontal()
 
 void DroneControl::testFlightVertical()
 {
+  MissionProfiler::Span span(profiler_, "testFlightVertical");
+
   ROS_INFO("Vertical test flight");
 
   for(int j = 0; ros::ok() && j < TEST_FLIGHT_REPEAT; ++j)
@@ -503,7 +572,7 @@ void DroneControl::testFlightVertical()
     {
       setpoint_pos_ENU_.pose.position.x += TEST_FLIGHT_LENGTH/TEST_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -511,7 +580,7 @@ void DroneControl::testFlightVertical()
     {
       setpoint_pos_ENU_.pose.position.z += TEST_FLIGHT_LENGTH/TEST_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -519,7 +588,7 @@ void DroneControl::testFlightVertical()
     {
       setpoint_pos_ENU_.pose.position.x -= TEST_FLIGHT_LENGTH/TEST_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -527,7 +596,7 @@ void DroneControl::testFlightVertical()
     {
       setpoint_pos_ENU_.pose.position.z -= TEST_FLIGHT_LENGTH/TEST_FLIGHT_DURATION/ROS_RATE;
 
-      ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+      publishSetpoint(setpoint_pos_ENU_);
       ros::spinOnce();
       rate_->sleep();
     }
@@ -536,6 +605,8 @@ void DroneControl::testFlightVertical()
 
 void DroneControl::flyToGlobal(double latitude, double longitude, double altitude, double yaw)
 {
+  MissionProfiler::Span span(profiler_, "flyToGlobal");
+
   mavros_msgs::GlobalPositionTarget target;
   target.coordinate_frame = mavros_msgs::GlobalPositionTarget::FRAME_GLOBAL_INT;
   target.type_mask = mavros_msgs::GlobalPositionTarget::IGNORE_VX |
@@ -564,6 +635,8 @@ void DroneControl::flyToGlobal(double latitude, double longitude, double altitud
 
 void DroneControl::flyToLocal(double x, double y, double z, double yaw)
 {
+  MissionProfiler::Span span(profiler_, "flyToLocal");
+
   if(!std::isfinite(yaw))
   {
     yaw = currentYaw();
@@ -578,7 +651,8 @@ void DroneControl::flyToLocal(double x, double y, double z, double yaw)
 
   while(ros::ok() && distance(setpoint_pos_ENU_, local_position_) > 0.5)
   {
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    profiler_->dataAge("local_position", local_position_.header.stamp);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -586,7 +660,7 @@ void DroneControl::flyToLocal(double x, double y, double z, double yaw)
   //Publish for another second
   for(int i = 0; ros::ok() && i < 1 * ROS_RATE; ++i)
   {
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -594,6 +668,8 @@ void DroneControl::flyToLocal(double x, double y, double z, double yaw)
 
 void DroneControl::flyToLocalNoCollision(double x, double y, double z)
 {
+  MissionProfiler::Span span(profiler_, "flyToLocalNoCollision");
+
   int i, cnt = 0;
 
   geometry_msgs::PoseStamped endpoint;
@@ -606,17 +682,24 @@ void DroneControl::flyToLocalNoCollision(double x, double y, double z)
 
   for(i = 0; ros::ok() && cnt < 2 * ROS_RATE && i < 2*MAX_ATTEMPTS; ++i)
   {
+    profiler_->dataAge("local_position", local_position_.header.stamp);
     if(distance(endpoint, local_position_) < 0.5) cnt++;
 
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
-  if(i == MAX_ATTEMPTS) ROS_WARN("2*MAX_ATTEMPTS reached while flying to local coordinates. Aborting.");
+  if(i == 2*MAX_ATTEMPTS)
+  {
+    ROS_WARN("2*MAX_ATTEMPTS reached while flying to local coordinates. Aborting.");
+    profiler_->timeout("flyToLocalNoCollision");
+  }
 }
 
 void DroneControl::hover(double seconds)
 {
+  MissionProfiler::Span span(profiler_, "hover");
+
   ROS_INFO("Hovering for %f seconds in position: E: %f, N: %f, U: %f", seconds,
            setpoint_pos_ENU_.pose.position.x,
            setpoint_pos_ENU_.pose.position.y,
@@ -624,7 +707,7 @@ void DroneControl::hover(double seconds)
 
   for(int i = 0; ros::ok() && i < 15 * ROS_RATE; ++i)
   {
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -634,6 +717,8 @@ void DroneControl::hover(double seconds)
 
 void DroneControl::scanBuilding()
 {
+  MissionProfiler::Span span(profiler_, "scanBuilding");
+
   ROS_INFO("Scanning building");
   double yaw = currentYaw();
 
@@ -667,28 +752,38 @@ void DroneControl::scanBuilding()
 
 void DroneControl::scanUntil(const geometry_msgs::PoseStamped &endpoint)
 {
+  MissionProfiler::Span span(profiler_, "scanUntil");
+
   int i, cnt = 0;
 
   ros_client_->publishTrajectoryEndpoint(endpoint);
 
   for(i = 0; ros::ok() && cnt < 2 * ROS_RATE && !marker_found_ && i < 2*MAX_ATTEMPTS; ++i)
   {
+    profiler_->dataAge("local_position", local_position_.header.stamp);
     if(distance(endpoint, local_position_) < 0.5) cnt++;
 
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
 
+    profiler_->dataAge("marker_position", marker_position_.header.stamp);
     if(ros::Time::now() - marker_position_.header.stamp < ros::Duration(0.5))
     {
       marker_found_ = true;
     }
   }
-  if(i == MAX_ATTEMPTS) ROS_WARN("2*MAX_ATTEMPTS reached while scanning building. Aborting.");
+  if(i == 2*MAX_ATTEMPTS)
+  {
+    ROS_WARN("2*MAX_ATTEMPTS reached while scanning building. Aborting.");
+    profiler_->timeout("scanUntil");
+  }
 }
 
 void DroneControl::centerMarker()
 {
+  MissionProfiler::Span span(profiler_, "centerMarker");
+
   // Center the marker without change of orientation
   int i, cnt = 0;
   double yaw = currentYaw();
@@ -716,18 +811,23 @@ void DroneControl::centerMarker()
 
   for(i = 0; ros::ok() && cnt < 2 * ROS_RATE && i < MAX_ATTEMPTS; ++i)
   {
+    profiler_->dataAge("local_position", local_position_.header.stamp);
     if(distance(endpoint_pos_ENU_, local_position_) < 0.5) cnt++;
 
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
-  if(i == MAX_ATTEMPTS) ROS_WARN("MAX_ATTEMPTS reached while centering marker. Aborting.");
+  if(i == MAX_ATTEMPTS)
+  {
+    ROS_WARN("MAX_ATTEMPTS reached while centering marker. Aborting.");
+    profiler_->timeout("centerMarker");
+  }
 
   // Send setpoint for another second
   for(int i = 0; ros::ok() && i < 1 * ROS_RATE; ++i)
   {
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -737,6 +837,8 @@ void DroneControl::centerMarker()
 
 void DroneControl::turnTowardsMarker()
 {
+  MissionProfiler::Span span(profiler_, "turnTowardsMarker");
+
   double rad, current_yaw;
 
   // Turn towards the marker without change of position
@@ -746,6 +848,7 @@ void DroneControl::turnTowardsMarker()
   {
     current_yaw = currentYaw();
 
+    profiler_->dataAge("marker_position", marker_position_.header.stamp);
     if(ros::Time::now() - marker_position_.header.stamp < ros::Duration(1.0))
     {
       // Calculate yaw angle difference of marker in radians
@@ -764,7 +867,7 @@ void DroneControl::turnTowardsMarker()
       ROS_INFO("No marker was found in the last second, turning around");
       setpoint_pos_ENU_.pose.orientation = tf::createQuaternionMsgFromYaw(current_yaw+TURN_STEP_RAD);
     }
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -772,7 +875,7 @@ void DroneControl::turnTowardsMarker()
   // Send setpoint for 2 seconds
   for(int i = 0; ros::ok() && i < 2 * ROS_RATE; ++i)
   {
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -782,25 +885,29 @@ void DroneControl::turnTowardsMarker()
 
 void DroneControl::approachMarker()
 {
+  MissionProfiler::Span span(profiler_, "approachMarker");
+
   int i, j, cnt = 0;
   approaching_ = true;
 
   // TODO: handle after MAX_ATTEMPTS
   for(j = 0; ros::ok() && j < MAX_ATTEMPTS; ++j)
   {
+    profiler_->dataAge("marker_position", marker_position_.header.stamp);
     if(ros::Time::now() - marker_position_.header.stamp < ros::Duration(1.0))
     {
       if(ros_client_->avoidCollision_)
       {
         for(i = 0; ros::ok() && !endpoint_active_ && i < MAX_ATTEMPTS; ++i)
         {
-          ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+          publishSetpoint(setpoint_pos_ENU_);
           ros::spinOnce();
           rate_->sleep();
         }
         if(i == MAX_ATTEMPTS)
         {
           ROS_WARN("MAX_ATTEMPTS reached while waiting for endpoint (while approaching marker). Aborting.");
+          profiler_->timeout("approachMarker");
           break;
         }
         ros_client_->publishTrajectoryEndpoint(endpoint_pos_ENU_);
@@ -808,18 +915,21 @@ void DroneControl::approachMarker()
 
         for(i = 0; ros::ok() && marker_position_.poses[0].position.z > 0.6 && i < MAX_ATTEMPTS; ++i)
         {
-          if(distance(current_endpoint, endpoint_pos_ENU_) > marker_position_.poses[0].position.z/6.0)
+          profiler_->dataAge("marker_position", marker_position_.header.stamp);
+          predictEndpoint();
+          if(endpointChanged(current_endpoint))
           {
             ros_client_->publishTrajectoryEndpoint(endpoint_pos_ENU_);
             current_endpoint = endpoint_pos_ENU_;
           }
-          ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+          publishSetpoint(setpoint_pos_ENU_);
           ros::spinOnce();
           rate_->sleep();
         }
         if(i == MAX_ATTEMPTS)
         {
           ROS_WARN("MAX_ATTEMPTS reached while approaching marker in collision avoidance mode. Aborting.");
+          profiler_->timeout("approachMarker");
           break;
         }
         ROS_INFO("Close enough");
@@ -840,7 +950,8 @@ void DroneControl::approachMarker()
         }
         else {close_enough_ = 0;}
 
-        ros_client_->setpoint_pos_pub_.publish(endpoint_pos_ENU_);
+        predictEndpoint();
+        publishSetpoint(endpoint_pos_ENU_);
         ros::spinOnce();
 
         approaching_ = true;
@@ -855,12 +966,16 @@ void DroneControl::approachMarker()
     ros::spinOnce();
     rate_->sleep();
   }
-  if(j == MAX_ATTEMPTS) ROS_WARN("MAX_ATTEMPTS reached while approaching marker. Aborting.");
+  if(j == MAX_ATTEMPTS)
+  {
+    ROS_WARN("MAX_ATTEMPTS reached while approaching marker. Aborting.");
+    profiler_->timeout("approachMarker");
+  }
 
   // Publish final setpoint for 3 seconds before landing
   for(int i = 0; ros::ok() && i < 3 * ROS_RATE; ++i)
   {
-    ros_client_->setpoint_pos_pub_.publish(endpoint_pos_ENU_);
+    publishSetpoint(endpoint_pos_ENU_);
     ros::spinOnce();
     rate_->sleep();
   }
@@ -873,6 +988,8 @@ void DroneControl::approachMarker()
 
 void DroneControl::land()
 {
+  MissionProfiler::Span span(profiler_, "land");
+
   int i;
   mavros_msgs::CommandTOL land_cmd;
   land_cmd.request.yaw = 0;
@@ -883,12 +1000,15 @@ void DroneControl::land()
   ROS_INFO("Trying to land");
   while(!(ros_client_->land_client_.call(land_cmd) && land_cmd.response.success))
   {
-    ros_client_->setpoint_pos_pub_.publish(setpoint_pos_ENU_);
+    publishSetpoint(setpoint_pos_ENU_);
     ros::spinOnce();
     ROS_WARN("Retrying to land");
     rate_->sleep();
   }
 
+  // Offboard setpoints are not needed anymore once the landing mode is active
+  setpoint_streamer_->stop();
+
   // Wait until proper landing (or a maximum of 15 seconds)
   for(i = 0; ros::ok() && landed_state_ != mavros_msgs::ExtendedState::LANDED_STATE_ON_GROUND && i < MAX_ATTEMPTS; ++i)
   {
@@ -896,7 +1016,10 @@ void DroneControl::land()
     rate_->sleep();
   }
   if(i == MAX_ATTEMPTS)
+  {
     ROS_WARN("Landing failed, aborting");
+    profiler_->timeout("land");
+  }
   else
     ROS_INFO("Landing success");
 
@@ -906,6 +1029,8 @@ void DroneControl::land()
 
 void DroneControl::disarm()
 {
+  MissionProfiler::Span span(profiler_, "disarm");
+
   // Disarm
   arm_cmd_.request.value = false;
   while(ros::ok() && current_state_.armed)
@@ -924,6 +1049,52 @@ void DroneControl::disarm()
   return;
 }
 
+void DroneControl::printProfile()
+{
+  profiler_->printSummary();
+  profiler_->flush();
+}
+
+void DroneControl::predictEndpoint()
+{
+  if(!marker_filter_.initialized()) return;
+
+  Eigen::Vector3d marker;
+  Eigen::Matrix3d covariance;
+  marker_filter_.predict(ros::Time::now(), marker, covariance);
+
+  Eigen::Vector3d endpoint = marker + endpoint_offset_;
+  endpoint_pos_ENU_.header.stamp = ros::Time::now();
+  endpoint_pos_ENU_.header.frame_id = "world";
+  endpoint_pos_ENU_.pose.position.x = endpoint[0];
+  endpoint_pos_ENU_.pose.position.y = endpoint[1];
+  endpoint_pos_ENU_.pose.position.z = endpoint[2];
+  endpoint_pos_ENU_.pose.orientation = tf::createQuaternionMsgFromYaw(endpoint_yaw_);
+
+  geometry_msgs::PointStamped point_of_interest;
+  point_of_interest.header = endpoint_pos_ENU_.header;
+  point_of_interest.point.x = marker[0];
+  point_of_interest.point.y = marker[1];
+  point_of_interest.point.z = marker[2];
+  ros_client_->publishPointOfInterest(point_of_interest);
+}
+
+bool DroneControl::endpointChanged(const geometry_msgs::PoseStamped &published)
+{
+  // Replan only if the published endpoint is unlikely given the filtered marker position
+  Eigen::Vector3d endpoint(published.pose.position.x, published.pose.position.y, published.pose.position.z);
+  return marker_filter_.mahalanobis2(endpoint - endpoint_offset_, ros::Time::now()) > MarkerFilter::CHI2_3DOF_99;
+}
+
+void DroneControl::publishSetpoint(const geometry_msgs::PoseStamped &setpoint)
+{
+  // The streamer interpolates towards the setpoint and publishes at a higher rate on its own thread
+  if(setpoint_streamer_->isRunning())
+    setpoint_streamer_->setTarget(setpoint);
+  else
+    ros_client_->setpoint_pos_pub_.publish(setpoint);
+}
+
 double DroneControl::currentYaw()
 {
   //Calculate yaw current orientation
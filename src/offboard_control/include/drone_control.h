@@ -8,6 +8,9 @@
 #define DRONE_CONTROL_H
 
 #include "ros_client.h"
+#include "setpoint_streamer.h"
+#include "mission_profiler.h"
+#include "marker_filter.h"
 
 #include <ros/ros.h>
 #include <std_msgs/String.h>
@@ -19,6 +22,8 @@
 #include <geometry_msgs/PoseArray.h>
 #include <geometry_msgs/TransformStamped.h>
 #include <sensor_msgs/NavSatFix.h>
+#include <trajectory_planner/BSplineTrajectory.h>
+#include <whycon/MarkerIds.h>
 #include <tf2_ros/transform_listener.h>
 #include <math.h>
 
@@ -44,6 +49,7 @@ class DroneControl
     static constexpr int   TEST_FLIGHT_REPEAT = 2;     //Times
     static constexpr bool  KEEP_ALIVE = true;
     static constexpr bool  USE_MARKER_ORIENTATION = false;
+    static constexpr bool  USE_SETPOINT_STREAMER = true;
     static constexpr double LAT_DEG_TO_M = 111000.0;
     static constexpr double LON_DEG_TO_M = 75000.0;
 
@@ -58,12 +64,16 @@ class DroneControl
     geometry_msgs::PoseWithCovarianceStamped svo_position_;
     geometry_msgs::TransformStamped transformStamped_;
 
+    // ID of the marker to approach (~marker_id), -1 uses the first detected marker without decoding IDs
+    int marker_id_ = -1;
+
     void state_cb(const mavros_msgs::State::ConstPtr &msg);
     void extended_state_cb(const mavros_msgs::ExtendedState::ConstPtr &msg);
     void marker_position_cb(const geometry_msgs::PoseArray::ConstPtr &msg);
+    void marker_ids_cb(const geometry_msgs::PoseArray::ConstPtr &poses, const whycon::MarkerIds::ConstPtr &ids);
     void local_position_cb(const geometry_msgs::PoseStamped::ConstPtr &msg);
     void global_position_cb(const sensor_msgs::NavSatFix::ConstPtr &msg);
-    void setpoint_position_cb(const geometry_msgs::PoseStamped::ConstPtr &msg);
+    void trajectory_cb(const trajectory_planner::BSplineTrajectory::ConstPtr &msg);
     void svo_position_cb(const geometry_msgs::PoseWithCovarianceStamped::ConstPtr &msg);
 
     void offboardMode();
@@ -86,6 +96,7 @@ class DroneControl
     void hover(double seconds);
     void land();
     void disarm();
+    void printProfile();
 
   private:
     bool approaching_ = false;
@@ -106,12 +117,21 @@ class DroneControl
     ros::Time last_request_;
     ros::Time last_svo_estimate_;
 
+    SetpointStreamer *setpoint_streamer_;
+    MarkerFilter marker_filter_;
+    Eigen::Vector3d endpoint_offset_;  // From the marker to the target position in the world frame
+    double endpoint_yaw_ = 0;
+    MissionProfiler *profiler_;
+
     mavros_msgs::CommandBool arm_cmd_;
     std_msgs::String svo_cmd_;
     std_msgs::String ewok_cmd_;
 
     ROSClient *ros_client_;
 
+    void publishSetpoint(const geometry_msgs::PoseStamped &setpoint);
+    void predictEndpoint();
+    bool endpointChanged(const geometry_msgs::PoseStamped &published);
     double currentYaw();
     double getYaw(const geometry_msgs::Quaternion &msg);
     double distance(const geometry_msgs::PoseStamped &p1, const geometry_msgs::PoseStamped &p2);
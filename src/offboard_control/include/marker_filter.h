@@ -0,0 +1,55 @@
+#ifndef MARKER_FILTER_H
+#define MARKER_FILTER_H
+
+#include <ros/ros.h>
+#include <Eigen/Dense>
+
+/**
+ * Constant-velocity Kalman filter on the marker position in the world frame.
+ * Detections are fused at their image stamp, the state can be predicted to
+ * any later time, e.g. at controller rate, without changing the filter.
+ */
+class MarkerFilter
+{
+  public:
+    MarkerFilter();
+
+    typedef Eigen::Matrix<double, 6, 1> Vector6;
+    typedef Eigen::Matrix<double, 6, 6> Matrix6;
+
+    static constexpr double ACCELERATION_NOISE = 0.2;  //In m/s^2, white noise acceleration of the marker
+    static constexpr double MEASUREMENT_NOISE = 0.03;  //In meters per meter of distance from the camera
+    static constexpr double MIN_MEASUREMENT_NOISE = 0.02; //In meters
+    static constexpr double INITIAL_VELOCITY_STD = 0.5; //In m/s
+    static constexpr double MAX_PREDICTION = 0.5;      //In seconds, the velocity is not extrapolated further
+    static constexpr double RESET_TIMEOUT = 1.0;       //In seconds without detection until the filter restarts
+    static constexpr int    MAX_REJECTED = 5;          //Consecutive outliers until the filter restarts
+
+    // Quantiles of the chi-squared distribution with 3 degrees of freedom
+    static constexpr double CHI2_3DOF_99 = 11.34;
+    static constexpr double CHI2_3DOF_999 = 16.27;
+
+    void reset();
+    bool initialized() const;
+
+    // Returns false if the detection was rejected as an outlier
+    bool update(const Eigen::Vector3d &position, double distance, const ros::Time &stamp);
+    void predict(const ros::Time &stamp, Eigen::Vector3d &position, Eigen::Matrix3d &covariance) const;
+
+    // Squared Mahalanobis distance of a point from the predicted marker position
+    double mahalanobis2(const Eigen::Vector3d &position, const ros::Time &stamp) const;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  private:
+    void propagate(double dt, Vector6 &x, Matrix6 &P) const;
+
+    bool initialized_ = false;
+    int rejected_ = 0;
+
+    ros::Time stamp_;
+    Vector6 x_;
+    Matrix6 P_;
+};
+
+#endif /* MARKER_FILTER_H */
@@ -0,0 +1,96 @@
+#ifndef MISSION_PROFILER_H
+#define MISSION_PROFILER_H
+
+#include <ros/ros.h>
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Records the timeline of a mission: begin and end of every behaviour,
+ * MAX_ATTEMPTS timeouts and the age of the data a decision was based on.
+ * Events are appended to a compact binary trace which can be converted to
+ * the Chrome trace format with scripts/trace_to_chrome.py, durations, timeout
+ * counts and data-age histograms are printed with printSummary().
+ *
+ * Trace layout (little-endian): the magic "MTRC" and a uint32 version,
+ * followed by records starting with a uint8 type. NAME records define a
+ * name id: uint8 length, uint16 id and the characters. All other records are
+ * 16 bytes: uint8 type, uint8 reserved, uint16 name id, float32 value and
+ * int64 stamp in nanoseconds.
+ */
+class MissionProfiler
+{
+  public:
+    MissionProfiler(const std::string &trace_file);
+    ~MissionProfiler();
+
+    enum RecordType : uint8_t
+    {
+      NAME = 0,
+      BEGIN = 1,
+      END = 2,
+      TIMEOUT = 3,
+      DATA_AGE = 4  // value is the age in seconds
+    };
+
+    static constexpr uint32_t TRACE_VERSION = 1;
+    static constexpr int AGE_BUCKETS = 8;
+
+    // Upper bounds of the data age histogram buckets in seconds, the last bucket is open
+    static const double AGE_BUCKET_LIMITS[AGE_BUCKETS - 1];
+
+    // Marks a behaviour from construction until it goes out of scope
+    class Span
+    {
+      public:
+        Span(MissionProfiler *profiler, const char *name);
+        ~Span();
+
+      private:
+        MissionProfiler *profiler_;
+        const char *name_;
+    };
+
+    void begin(const char *name);
+    void end(const char *name);
+    void timeout(const char *name);
+    // Samples with a zero stamp (nothing received yet) are only counted, not added to the histogram
+    void dataAge(const char *name, const ros::Time &stamp);
+
+    void printSummary() const;
+    void flush();
+
+  private:
+    struct SpanStats
+    {
+      ros::Time begin;
+      int count = 0;
+      double total = 0;
+      double max = 0;
+      int timeouts = 0;
+    };
+
+    struct AgeHistogram
+    {
+      int count = 0;
+      int never_received = 0;
+      double sum = 0;
+      double max = 0;
+      int buckets[AGE_BUCKETS] = {};
+    };
+
+    uint16_t nameId(const char *name);
+    void write(RecordType type, uint16_t id, float value, const ros::Time &stamp);
+
+    std::ofstream trace_;
+    std::unordered_map<std::string, uint16_t> name_ids_;
+
+    std::map<std::string, SpanStats> spans_;
+    std::map<std::string, AgeHistogram> ages_;
+};
+
+#endif /* MISSION_PROFILER_H */
@@ -0,0 +1,108 @@
+/**
+ * @file mission_simulator.h
+ * @brief Lightweight stand-in for mavros and the flight controller, so that
+ * complete missions of the offboard control node can be run faster than real
+ * time without PX4 SITL and Gazebo
+ */
+
+#ifndef MISSION_SIMULATOR_H
+#define MISSION_SIMULATOR_H
+
+#include <ros/ros.h>
+#include <mavros_msgs/State.h>
+#include <mavros_msgs/ExtendedState.h>
+#include <mavros_msgs/PositionTarget.h>
+#include <mavros_msgs/CommandBool.h>
+#include <mavros_msgs/CommandTOL.h>
+#include <mavros_msgs/SetMode.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/PoseArray.h>
+#include <whycon/MarkerIds.h>
+#include <tf/tf.h>
+
+/**
+ * Simulates the vehicle as a double integrator with a PD position controller
+ * tracking the offboard setpoints, and a first-order yaw response. The
+ * simulation publishes its own /clock, all other nodes have to run with
+ * /use_sim_time set. Detections of a single marker are published on
+ * /whycon/poses in the camera optical frame while it is in the field of view,
+ * together with its ID (~marker_id) on /whycon/ids.
+ */
+class MissionSimulator
+{
+  public:
+    MissionSimulator();
+
+    static constexpr double SIM_DT = 0.005;           //In seconds per simulation step
+    static constexpr double STATE_RATE = 1.0;         //In Hz, as mavros
+    static constexpr double POSITION_RATE = 30.0;     //In Hz
+    static constexpr double MARKER_RATE = 15.0;       //In Hz, camera frame rate
+    static constexpr double POSITION_GAIN = 2.0;      //In 1/s^2
+    static constexpr double VELOCITY_GAIN = 2.5;      //In 1/s
+    static constexpr double YAW_TIME_CONSTANT = 0.3;  //In seconds
+    static constexpr double MAX_VELOCITY = 3.0;       //In m/s
+    static constexpr double MAX_ACCELERATION = 4.0;   //In m/s^2
+    static constexpr double LAND_VELOCITY = 0.7;      //In m/s
+    static constexpr double OFFBOARD_TIMEOUT = 0.5;   //In seconds without setpoints until failsafe, as PX4
+    static constexpr double CAMERA_OFFSET = 0.1;      //In meters in front of the drone, as in DroneControl
+    static constexpr double CAMERA_HFOV = 1.2;        //In radians
+    static constexpr double CAMERA_VFOV = 0.9;        //In radians
+    static constexpr double CAMERA_RANGE = 15.0;      //In meters
+
+    void run();
+
+  private:
+    void setpoint_raw_cb(const mavros_msgs::PositionTarget::ConstPtr &msg);
+    void setpoint_position_cb(const geometry_msgs::PoseStamped::ConstPtr &msg);
+    bool set_mode_cb(mavros_msgs::SetMode::Request &req, mavros_msgs::SetMode::Response &res);
+    bool arming_cb(mavros_msgs::CommandBool::Request &req, mavros_msgs::CommandBool::Response &res);
+    bool land_cb(mavros_msgs::CommandTOL::Request &req, mavros_msgs::CommandTOL::Response &res);
+
+    void step();
+    void publishState();
+    void publishLocalPosition();
+    void publishMarker();
+    void printSummary();
+
+    ros::NodeHandle nh_;
+
+    ros::Subscriber setpoint_raw_sub_;
+    ros::Subscriber setpoint_pos_sub_;
+    ros::Publisher clock_pub_;
+    ros::Publisher state_pub_;
+    ros::Publisher extended_state_pub_;
+    ros::Publisher local_pos_pub_;
+    ros::Publisher marker_pos_pub_;
+    ros::Publisher marker_ids_pub_;
+    ros::ServiceServer set_mode_srv_;
+    ros::ServiceServer arming_srv_;
+    ros::ServiceServer land_srv_;
+
+    double real_time_factor_;
+    bool exit_on_disarm_;
+
+    ros::Time now_;
+    ros::Time last_setpoint_;
+    ros::Time mission_start_;
+    ros::WallTime wall_start_;
+
+    mavros_msgs::State state_;
+    uint8_t landed_state_ = mavros_msgs::ExtendedState::LANDED_STATE_ON_GROUND;
+
+    tf::Vector3 position_, velocity_;
+    double yaw_ = 0;
+
+    tf::Vector3 setpoint_pos_, setpoint_vel_, setpoint_acc_;
+    double setpoint_yaw_ = 0;
+
+    tf::Vector3 marker_position_;
+    int marker_id_;
+
+    // Mission statistics
+    int setpoints_received_ = 0;
+    int failsafes_ = 0;
+    int marker_detections_ = 0;
+    double max_setpoint_gap_ = 0;
+};
+
+#endif /* MISSION_SIMULATOR_H */
@@ -5,6 +5,11 @@
 
 #include <ros/ros.h>
 #include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/PoseArray.h>
+#include <geometry_msgs/PointStamped.h>
+#include <message_filters/subscriber.h>
+#include <message_filters/time_synchronizer.h>
+#include <whycon/MarkerIds.h>
 
 class DroneControl; // Forward declaration because of circular reference
 
@@ -21,11 +26,18 @@ class ROSClient
     ros::Subscriber local_pos_sub_;
     ros::Subscriber global_pos_sub_;
     ros::Subscriber svo_pos_sub_;
-    ros::Subscriber setpoint_pos_sub_;
+    ros::Subscriber trajectory_sub_;
+
+    // Used instead of marker_pos_sub_ when following a single marker ID
+    message_filters::Subscriber<geometry_msgs::PoseArray> *marker_poses_filter_sub_ = nullptr;
+    message_filters::Subscriber<whycon::MarkerIds> *marker_ids_filter_sub_ = nullptr;
+    message_filters::TimeSynchronizer<geometry_msgs::PoseArray, whycon::MarkerIds> *marker_sync_ = nullptr;
 
     ros::Publisher global_setpoint_pos_pub_;
     ros::Publisher setpoint_pos_pub_;
+    ros::Publisher setpoint_raw_pub_;
     ros::Publisher endpoint_pos_pub_;
+    ros::Publisher point_of_interest_pub_;
     ros::Publisher vision_pos_pub_;
     ros::Publisher svo_cmd_pub_;
     ros::Publisher ewok_cmd_pub_;
@@ -35,6 +47,7 @@ class ROSClient
     ros::ServiceClient set_mode_client_;
 
     void publishTrajectoryEndpoint(const geometry_msgs::PoseStamped& setpoint_pos_ENU);
+    void publishPointOfInterest(const geometry_msgs::PointStamped& point_ENU);
     void setParam(const std::string &key, double d);
 
     bool avoidCollision_;
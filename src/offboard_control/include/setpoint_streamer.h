@@ -0,0 +1,74 @@
+#ifndef SETPOINT_STREAMER_H
+#define SETPOINT_STREAMER_H
+
+#include <ros/ros.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <mavros_msgs/PositionTarget.h>
+#include <tf/tf.h>
+#include <trajectory_planner/BSplineTrajectory.h>
+#include <ewok/uniform_bspline_3d_evaluator.h>
+
+#include <mutex>
+#include <thread>
+
+/**
+ * Streams position, velocity and acceleration setpoints on setpoint_raw/local
+ * from a dedicated thread. Targets handed over by the (blocking) mission
+ * behaviours are not forwarded as steps, but reached on a minimum-jerk
+ * trajectory which is sampled at STREAM_RATE.
+ * While the planner keeps sending B-spline trajectories, these are sampled
+ * instead and targets are ignored.
+ */
+class SetpointStreamer
+{
+  public:
+    typedef ewok::UniformBSpline3DEvaluator<6> Spline;
+
+    SetpointStreamer(const ros::Publisher &setpoint_raw_pub);
+    ~SetpointStreamer();
+
+    static constexpr float STREAM_RATE = 50.0;
+    static constexpr float MAX_VELOCITY = 1.0;        //In m/s, peak velocity of a transition
+    static constexpr float MIN_TRANSITION_TIME = 0.5; //In seconds
+    static constexpr double TARGET_TOLERANCE = 1e-3;  //In meters
+    static constexpr float TRAJECTORY_TIMEOUT = 1.0;  //In seconds without a new trajectory
+
+    void start(const geometry_msgs::PoseStamped &initial_pose);
+    void stop();
+    bool isRunning() const;
+
+    void setTarget(const geometry_msgs::PoseStamped &target);
+    void setTrajectory(const ros::Time &start, const Spline::Ptr &spline, double yaw);
+
+    // Returns an empty pointer if the message does not describe a usable spline
+    static Spline::Ptr makeSpline(const trajectory_planner::BSplineTrajectory &msg);
+
+  private:
+    // Quintic polynomial per axis from the current reference state to a target at rest
+    struct Transition
+    {
+      ros::Time start;
+      double duration;
+      double coeffs[3][6];
+    };
+
+    void run();
+    bool followingTrajectory(const ros::Time &time) const;
+    void evaluate(const ros::Time &time, tf::Vector3 &pos, tf::Vector3 &vel, tf::Vector3 &acc) const;
+    void fillMessage(const ros::Time &time, mavros_msgs::PositionTarget &msg) const;
+
+    ros::Publisher setpoint_raw_pub_;
+
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    bool running_ = false;
+
+    Transition transition_;
+    Spline::Ptr trajectory_;
+    ros::Time trajectory_start_;
+    ros::Time trajectory_received_;
+    tf::Vector3 target_pos_;
+    double target_yaw_ = 0;
+};
+
+#endif /* SETPOINT_STREAMER_H */
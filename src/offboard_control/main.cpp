@@ -34,6 +34,8 @@ int main(int argc, char **argv)
   drone_control.land();
   drone_control.disarm();
 
+  drone_control.printProfile();
+
   while(ros::ok() && DroneControl::KEEP_ALIVE)
   {
     ros::spin();
@@ -0,0 +1,114 @@
+#include "include/marker_filter.h"
+
+#include <algorithm>
+
+MarkerFilter::MarkerFilter()
+{
+  reset();
+}
+
+void MarkerFilter::reset()
+{
+  initialized_ = false;
+  rejected_ = 0;
+  x_.setZero();
+  P_.setIdentity();
+}
+
+bool MarkerFilter::initialized() const
+{
+  return initialized_;
+}
+
+bool MarkerFilter::update(const Eigen::Vector3d &position, double distance, const ros::Time &stamp)
+{
+  double sigma = std::max(MEASUREMENT_NOISE * distance, (double)MIN_MEASUREMENT_NOISE);
+  Eigen::Matrix3d R = Eigen::Matrix3d::Identity() * sigma * sigma;
+
+  if(initialized_ && (stamp - stamp_).toSec() > RESET_TIMEOUT)
+  {
+    ROS_INFO("Marker lost for more than %f seconds, restarting marker filter", RESET_TIMEOUT);
+    reset();
+  }
+
+  if(!initialized_)
+  {
+    x_.head<3>() = position;
+    x_.tail<3>().setZero();
+    P_.setZero();
+    P_.topLeftCorner<3,3>() = R;
+    double velocity_var = INITIAL_VELOCITY_STD * INITIAL_VELOCITY_STD;
+    P_.bottomRightCorner<3,3>() = Eigen::Matrix3d::Identity() * velocity_var;
+    stamp_ = stamp;
+    initialized_ = true;
+    return true;
+  }
+
+  // Detections can arrive out of order, these are fused at the current filter time
+  Vector6 x = x_;
+  Matrix6 P = P_;
+  double dt = std::max((stamp - stamp_).toSec(), 0.0);
+  propagate(dt, x, P);
+
+  // The measurement is the position part of the state
+  Eigen::Vector3d innovation = position - x.head<3>();
+  Eigen::Matrix3d S = P.topLeftCorner<3,3>() + R;
+  Eigen::LDLT<Eigen::Matrix3d> S_ldlt(S);
+
+  if(innovation.dot(S_ldlt.solve(innovation)) > CHI2_3DOF_999)
+  {
+    if(++rejected_ >= MAX_REJECTED)
+    {
+      ROS_INFO("Marker moved, restarting marker filter");
+      reset();
+      return update(position, distance, stamp);
+    }
+    return false;
+  }
+  rejected_ = 0;
+
+  Eigen::Matrix<double, 6, 3> K = S_ldlt.solve(P.leftCols<3>().transpose()).transpose();
+  x_ = x + K * innovation;
+  P_ = P - K * P.topRows<3>();
+  P_ = (P_ + P_.transpose()) / 2; // Keep symmetric
+  stamp_ = std::max(stamp, stamp_);
+
+  return true;
+}
+
+void MarkerFilter::predict(const ros::Time &stamp, Eigen::Vector3d &position, Eigen::Matrix3d &covariance) const
+{
+  Vector6 x = x_;
+  Matrix6 P = P_;
+
+  double dt = std::min(std::max((stamp - stamp_).toSec(), 0.0), (double)MAX_PREDICTION);
+  propagate(dt, x, P);
+
+  position = x.head<3>();
+  covariance = P.topLeftCorner<3,3>();
+}
+
+double MarkerFilter::mahalanobis2(const Eigen::Vector3d &position, const ros::Time &stamp) const
+{
+  Eigen::Vector3d predicted;
+  Eigen::Matrix3d covariance;
+  predict(stamp, predicted, covariance);
+
+  Eigen::Vector3d diff = position - predicted;
+  return diff.dot(covariance.ldlt().solve(diff));
+}
+
+void MarkerFilter::propagate(double dt, Vector6 &x, Matrix6 &P) const
+{
+  Matrix6 F = Matrix6::Identity();
+  F.topRightCorner<3,3>() = Eigen::Matrix3d::Identity() * dt;
+
+  // Discretized white noise acceleration
+  double q = ACCELERATION_NOISE * ACCELERATION_NOISE;
+  Matrix6 Q;
+  Q << Eigen::Matrix3d::Identity() * q*dt*dt*dt/3, Eigen::Matrix3d::Identity() * q*dt*dt/2,
+       Eigen::Matrix3d::Identity() * q*dt*dt/2,   Eigen::Matrix3d::Identity() * q*dt;
+
+  x = F * x;
+  P = F * P * F.transpose() + Q;
+}
@@ -0,0 +1,160 @@
+#include "include/mission_profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+const double MissionProfiler::AGE_BUCKET_LIMITS[MissionProfiler::AGE_BUCKETS - 1] = {0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0};
+
+MissionProfiler::MissionProfiler(const std::string &trace_file)
+{
+  if(trace_file.empty()) return;
+
+  trace_.open(trace_file.c_str(), std::ios::binary | std::ios::trunc);
+  if(!trace_.is_open())
+  {
+    ROS_WARN("Could not open mission trace file %s", trace_file.c_str());
+    return;
+  }
+
+  uint32_t version = TRACE_VERSION;
+  trace_.write("MTRC", 4);
+  trace_.write(reinterpret_cast<const char *>(&version), sizeof(version));
+  ROS_INFO("Writing mission trace to %s", trace_file.c_str());
+}
+
+MissionProfiler::~MissionProfiler()
+{
+  flush();
+}
+
+MissionProfiler::Span::Span(MissionProfiler *profiler, const char *name)
+{
+  this->profiler_ = profiler;
+  this->name_ = name;
+  profiler_->begin(name_);
+}
+
+MissionProfiler::Span::~Span()
+{
+  profiler_->end(name_);
+}
+
+void MissionProfiler::begin(const char *name)
+{
+  ros::Time now = ros::Time::now();
+  spans_[name].begin = now;
+  write(BEGIN, nameId(name), 0, now);
+}
+
+void MissionProfiler::end(const char *name)
+{
+  ros::Time now = ros::Time::now();
+  SpanStats &stats = spans_[name];
+  double duration = (now - stats.begin).toSec();
+  stats.count++;
+  stats.total += duration;
+  stats.max = std::max(stats.max, duration);
+  write(END, nameId(name), duration, now);
+
+  // Behaviours are long enough to make this cheap, and keeps the trace of a crashed flight
+  flush();
+}
+
+void MissionProfiler::timeout(const char *name)
+{
+  spans_[name].timeouts++;
+  write(TIMEOUT, nameId(name), 0, ros::Time::now());
+}
+
+void MissionProfiler::dataAge(const char *name, const ros::Time &stamp)
+{
+  AgeHistogram &hist = ages_[name];
+  if(stamp.isZero())
+  {
+    hist.never_received++;
+    return;
+  }
+
+  ros::Time now = ros::Time::now();
+  double age = (now - stamp).toSec();
+
+  int bucket = std::upper_bound(AGE_BUCKET_LIMITS, AGE_BUCKET_LIMITS + AGE_BUCKETS - 1, age) - AGE_BUCKET_LIMITS;
+  hist.buckets[bucket]++;
+  hist.count++;
+  hist.sum += age;
+  hist.max = std::max(hist.max, age);
+
+  write(DATA_AGE, nameId(name), age, now);
+}
+
+void MissionProfiler::printSummary() const
+{
+  ROS_INFO("Mission profile:");
+  for(const auto &span : spans_)
+  {
+    const SpanStats &stats = span.second;
+    ROS_INFO("  %-24s %3d runs, total %8.2f s, max %8.2f s, %d timeouts", span.first.c_str(),
+             stats.count, stats.total, stats.max, stats.timeouts);
+  }
+
+  for(const auto &age : ages_)
+  {
+    const AgeHistogram &hist = age.second;
+    ROS_INFO("  %s age: %d samples, mean %.3f s, max %.3f s, %d before first message", age.first.c_str(), hist.count,
+             hist.count ? hist.sum / hist.count : 0.0, hist.max, hist.never_received);
+
+    std::string buckets;
+    char buf[48];
+    for(int i = 0; i < AGE_BUCKETS; ++i)
+    {
+      if(i < AGE_BUCKETS - 1) snprintf(buf, sizeof(buf), " <%gs: %d", AGE_BUCKET_LIMITS[i], hist.buckets[i]);
+      else snprintf(buf, sizeof(buf), " >=%gs: %d", AGE_BUCKET_LIMITS[i-1], hist.buckets[i]);
+      buckets += buf;
+    }
+    ROS_INFO("   %s", buckets.c_str());
+  }
+}
+
+void MissionProfiler::flush()
+{
+  if(trace_.is_open()) trace_.flush();
+}
+
+uint16_t MissionProfiler::nameId(const char *name)
+{
+  auto it = name_ids_.find(name);
+  if(it != name_ids_.end()) return it->second;
+
+  uint16_t id = name_ids_.size();
+  name_ids_[name] = id;
+
+  if(trace_.is_open())
+  {
+    uint8_t type = NAME;
+    uint8_t length = std::min<size_t>(strlen(name), 255);
+    trace_.write(reinterpret_cast<const char *>(&type), sizeof(type));
+    trace_.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    trace_.write(reinterpret_cast<const char *>(&id), sizeof(id));
+    trace_.write(name, length);
+  }
+
+  return id;
+}
+
+void MissionProfiler::write(RecordType type, uint16_t id, float value, const ros::Time &stamp)
+{
+  if(!trace_.is_open()) return;
+
+  struct
+  {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t id;
+    float value;
+    int64_t stamp;
+  } record = {type, 0, id, value, (int64_t)stamp.toNSec()};
+  static_assert(sizeof(record) == 16, "Trace records must be 16 bytes");
+
+  trace_.write(reinterpret_cast<const char *>(&record), sizeof(record));
+}
@@ -0,0 +1,300 @@
+#include "include/mission_simulator.h"
+
+#include <rosgraph_msgs/Clock.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Bound to the const references of the tf::Vector3 operators
+constexpr double MissionSimulator::SIM_DT;
+constexpr double MissionSimulator::POSITION_GAIN;
+constexpr double MissionSimulator::VELOCITY_GAIN;
+
+MissionSimulator::MissionSimulator()
+{
+  ros::NodeHandle private_nh("~");
+
+  // Ratio of simulated to wall clock time, 0 runs the simulation as fast as possible
+  private_nh.param("real_time_factor", real_time_factor_, 10.0);
+  private_nh.param("exit_on_disarm", exit_on_disarm_, true);
+
+  // Default marker position is in front of the building scanned by the mission in main.cpp
+  double marker_x, marker_y, marker_z;
+  private_nh.param("marker_x", marker_x, 10.0);
+  private_nh.param("marker_y", marker_y, -5.0);
+  private_nh.param("marker_z", marker_z, 1.5);
+  marker_position_.setValue(marker_x, marker_y, marker_z);
+  private_nh.param("marker_id", marker_id_, 0);
+
+  // Start well after zero so that uninitialized stamps never look recent
+  now_ = ros::Time(100.0);
+
+  state_.connected = true;
+  state_.armed = false;
+  state_.mode = "MANUAL";
+
+  position_.setZero();
+  velocity_.setZero();
+  setpoint_pos_.setZero();
+  setpoint_vel_.setZero();
+  setpoint_acc_.setZero();
+
+  setpoint_raw_sub_ = nh_.subscribe<mavros_msgs::PositionTarget>("/mavros/setpoint_raw/local", 10, &MissionSimulator::setpoint_raw_cb, this);
+  setpoint_pos_sub_ = nh_.subscribe<geometry_msgs::PoseStamped>("/mavros/setpoint_position/local", 10, &MissionSimulator::setpoint_position_cb, this);
+
+  clock_pub_ = nh_.advertise<rosgraph_msgs::Clock>("/clock", 10);
+  state_pub_ = nh_.advertise<mavros_msgs::State>("/mavros/state", 10);
+  extended_state_pub_ = nh_.advertise<mavros_msgs::ExtendedState>("/mavros/extended_state", 10);
+  local_pos_pub_ = nh_.advertise<geometry_msgs::PoseStamped>("/mavros/local_position/pose", 10);
+  marker_pos_pub_ = nh_.advertise<geometry_msgs::PoseArray>("/whycon/poses", 10);
+  marker_ids_pub_ = nh_.advertise<whycon::MarkerIds>("/whycon/ids", 10);
+
+  set_mode_srv_ = nh_.advertiseService("/mavros/set_mode", &MissionSimulator::set_mode_cb, this);
+  arming_srv_ = nh_.advertiseService("/mavros/cmd/arming", &MissionSimulator::arming_cb, this);
+  land_srv_ = nh_.advertiseService("/mavros/cmd/land", &MissionSimulator::land_cb, this);
+}
+
+void MissionSimulator::setpoint_raw_cb(const mavros_msgs::PositionTarget::ConstPtr &msg)
+{
+  // Only the fields used by the setpoint streamer are supported
+  if(!(msg->type_mask & mavros_msgs::PositionTarget::IGNORE_PX))
+    setpoint_pos_.setValue(msg->position.x, msg->position.y, msg->position.z);
+
+  if(msg->type_mask & mavros_msgs::PositionTarget::IGNORE_VX) setpoint_vel_.setZero();
+  else setpoint_vel_.setValue(msg->velocity.x, msg->velocity.y, msg->velocity.z);
+
+  if(msg->type_mask & mavros_msgs::PositionTarget::IGNORE_AFX) setpoint_acc_.setZero();
+  else setpoint_acc_.setValue(msg->acceleration_or_force.x, msg->acceleration_or_force.y, msg->acceleration_or_force.z);
+
+  if(!(msg->type_mask & mavros_msgs::PositionTarget::IGNORE_YAW)) setpoint_yaw_ = msg->yaw;
+
+  if(setpoints_received_ > 0) max_setpoint_gap_ = std::max(max_setpoint_gap_, (now_ - last_setpoint_).toSec());
+  last_setpoint_ = now_;
+  setpoints_received_++;
+}
+
+void MissionSimulator::setpoint_position_cb(const geometry_msgs::PoseStamped::ConstPtr &msg)
+{
+  tf::pointMsgToTF(msg->pose.position, setpoint_pos_);
+  setpoint_vel_.setZero();
+  setpoint_acc_.setZero();
+  setpoint_yaw_ = tf::getYaw(msg->pose.orientation);
+
+  if(setpoints_received_ > 0) max_setpoint_gap_ = std::max(max_setpoint_gap_, (now_ - last_setpoint_).toSec());
+  last_setpoint_ = now_;
+  setpoints_received_++;
+}
+
+bool MissionSimulator::set_mode_cb(mavros_msgs::SetMode::Request &req, mavros_msgs::SetMode::Response &res)
+{
+  // PX4 rejects OFFBOARD mode unless setpoints are already being streamed
+  if(req.custom_mode == "OFFBOARD" && (setpoints_received_ == 0 || now_ - last_setpoint_ > ros::Duration(OFFBOARD_TIMEOUT)))
+  {
+    ROS_WARN("Simulator: OFFBOARD mode rejected, no setpoints received");
+  }
+  else
+  {
+    state_.mode = req.custom_mode;
+    publishState();
+  }
+
+  res.mode_sent = true;
+  return true;
+}
+
+bool MissionSimulator::arming_cb(mavros_msgs::CommandBool::Request &req, mavros_msgs::CommandBool::Response &res)
+{
+  if(!req.value && landed_state_ != mavros_msgs::ExtendedState::LANDED_STATE_ON_GROUND)
+  {
+    ROS_WARN("Simulator: disarming rejected, vehicle is in the air");
+    res.success = false;
+    return true;
+  }
+
+  if(req.value && !state_.armed)
+  {
+    mission_start_ = now_;
+    wall_start_ = ros::WallTime::now();
+  }
+
+  state_.armed = req.value;
+  publishState();
+
+  res.success = true;
+  return true;
+}
+
+bool MissionSimulator::land_cb(mavros_msgs::CommandTOL::Request &req, mavros_msgs::CommandTOL::Response &res)
+{
+  if(!state_.armed)
+  {
+    res.success = false;
+    return true;
+  }
+
+  state_.mode = "AUTO.LAND";
+  publishState();
+
+  res.success = true;
+  return true;
+}
+
+void MissionSimulator::step()
+{
+  if(state_.armed && state_.mode == "OFFBOARD" && now_ - last_setpoint_ > ros::Duration(OFFBOARD_TIMEOUT))
+  {
+    ROS_WARN("Simulator: no setpoint for %f seconds, switching to failsafe", (now_ - last_setpoint_).toSec());
+    state_.mode = "AUTO.LOITER";
+    setpoint_pos_ = position_;
+    setpoint_vel_.setZero();
+    setpoint_acc_.setZero();
+    setpoint_yaw_ = yaw_;
+    failsafes_++;
+    publishState();
+  }
+
+  tf::Vector3 acceleration(0, 0, 0);
+  if(state_.armed && state_.mode == "AUTO.LAND")
+  {
+    acceleration = (tf::Vector3(0, 0, -LAND_VELOCITY) - velocity_) * VELOCITY_GAIN;
+  }
+  else if(state_.armed)
+  {
+    acceleration = setpoint_acc_ + (setpoint_pos_ - position_) * POSITION_GAIN + (setpoint_vel_ - velocity_) * VELOCITY_GAIN;
+    yaw_ += SIM_DT / YAW_TIME_CONSTANT * remainder(setpoint_yaw_ - yaw_, 2*M_PI);
+    yaw_ = remainder(yaw_, 2*M_PI);
+  }
+
+  if(acceleration.length() > MAX_ACCELERATION) acceleration = acceleration * (MAX_ACCELERATION / acceleration.length());
+
+  velocity_ = velocity_ + acceleration * SIM_DT;
+  if(velocity_.length() > MAX_VELOCITY) velocity_ = velocity_ * (MAX_VELOCITY / velocity_.length());
+  if(!state_.armed) velocity_.setZero();
+
+  position_ = position_ + velocity_ * SIM_DT;
+
+  // Ground contact
+  uint8_t landed_state = mavros_msgs::ExtendedState::LANDED_STATE_IN_AIR;
+  if(position_.z() <= 0.0)
+  {
+    position_.setValue(position_.x(), position_.y(), 0.0);
+    velocity_.setZero();
+    landed_state = mavros_msgs::ExtendedState::LANDED_STATE_ON_GROUND;
+  }
+  else if(state_.mode == "AUTO.LAND")
+  {
+    landed_state = mavros_msgs::ExtendedState::LANDED_STATE_LANDING;
+  }
+
+  if(landed_state != landed_state_)
+  {
+    landed_state_ = landed_state;
+    mavros_msgs::ExtendedState msg;
+    msg.header.stamp = now_;
+    msg.landed_state = landed_state_;
+    extended_state_pub_.publish(msg);
+  }
+}
+
+void MissionSimulator::publishState()
+{
+  state_.header.stamp = now_;
+  state_pub_.publish(state_);
+
+  mavros_msgs::ExtendedState msg;
+  msg.header.stamp = now_;
+  msg.landed_state = landed_state_;
+  extended_state_pub_.publish(msg);
+}
+
+void MissionSimulator::publishLocalPosition()
+{
+  geometry_msgs::PoseStamped msg;
+  msg.header.stamp = now_;
+  msg.header.frame_id = "world";
+  tf::pointTFToMsg(position_, msg.pose.position);
+  msg.pose.orientation = tf::createQuaternionMsgFromYaw(yaw_);
+  local_pos_pub_.publish(msg);
+}
+
+void MissionSimulator::publishMarker()
+{
+  // Marker relative to the drone in its (level) body frame
+  tf::Vector3 rel = marker_position_ - position_;
+  double forward = cos(yaw_)*rel.x() + sin(yaw_)*rel.y() - CAMERA_OFFSET;
+  double left = -sin(yaw_)*rel.x() + cos(yaw_)*rel.y();
+  double up = rel.z();
+
+  // Camera optical frame: x right, y down, z forward
+  if(forward <= 0 || forward > CAMERA_RANGE) return;
+  if(fabs(left/forward) > tan(CAMERA_HFOV/2) || fabs(up/forward) > tan(CAMERA_VFOV/2)) return;
+
+  geometry_msgs::PoseArray msg;
+  msg.header.stamp = now_;
+  msg.header.frame_id = "camera";
+  msg.poses.resize(1);
+  msg.poses[0].position.x = -left;
+  msg.poses[0].position.y = -up;
+  msg.poses[0].position.z = forward;
+  msg.poses[0].orientation.w = 1;
+  marker_pos_pub_.publish(msg);
+
+  whycon::MarkerIds ids;
+  ids.header = msg.header;
+  ids.ids.push_back(marker_id_);
+  marker_ids_pub_.publish(ids);
+
+  marker_detections_++;
+}
+
+void MissionSimulator::printSummary()
+{
+  double sim_duration = (now_ - mission_start_).toSec();
+  double wall_duration = (ros::WallTime::now() - wall_start_).toSec();
+
+  ROS_INFO("Simulated mission finished");
+  ROS_INFO("  Mission time: %f s simulated, %f s wall clock (x%.1f)", sim_duration, wall_duration,
+           wall_duration > 0 ? sim_duration / wall_duration : 0.0);
+  ROS_INFO("  Setpoints: %d received, largest gap %f s, %d failsafes", setpoints_received_, max_setpoint_gap_, failsafes_);
+  ROS_INFO("  Marker: %d detections, landed %f m from marker", marker_detections_, position_.distance(marker_position_));
+}
+
+void MissionSimulator::run()
+{
+  const int position_steps = std::max(1, (int)std::round(1.0 / (POSITION_RATE * SIM_DT)));
+  const int marker_steps = std::max(1, (int)std::round(1.0 / (MARKER_RATE * SIM_DT)));
+  const int state_steps = std::max(1, (int)std::round(1.0 / (STATE_RATE * SIM_DT)));
+
+  ROS_INFO("Mission simulator running at %.1f times real time", real_time_factor_);
+
+  rosgraph_msgs::Clock clock;
+  ros::WallTime next_step = ros::WallTime::now();
+  bool was_armed = false;
+
+  for(long step_cnt = 0; ros::ok(); ++step_cnt)
+  {
+    now_ += ros::Duration(SIM_DT);
+    clock.clock = now_;
+    clock_pub_.publish(clock);
+
+    ros::spinOnce();
+    step();
+
+    if(step_cnt % position_steps == 0) publishLocalPosition();
+    if(step_cnt % marker_steps == 0) publishMarker();
+    if(step_cnt % state_steps == 0) publishState();
+
+    if(was_armed && !state_.armed)
+    {
+      printSummary();
+      if(exit_on_disarm_) break;
+    }
+    was_armed = state_.armed;
+
+    if(real_time_factor_ > 0)
+    {
+      next_step += ros::WallDuration(SIM_DT / real_time_factor_);
+      ros::WallTime::sleepUntil(next_step);
+    }
+  }
+}
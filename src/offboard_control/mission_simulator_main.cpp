@@ -0,0 +1,17 @@
+/**
+ * @file mission_simulator_main.cpp
+ * @brief Simulated vehicle for running offboard_control missions without
+ * PX4 SITL and Gazebo, see launch/offline_simulation.launch
+ */
+
+#include "include/mission_simulator.h"
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "mission_simulator");
+
+  MissionSimulator simulator;
+  simulator.run();
+
+  return 0;
+}
@@ -7,6 +7,7 @@
 #include <mavros_msgs/State.h>
 #include <mavros_msgs/ExtendedState.h>
 #include <mavros_msgs/GlobalPositionTarget.h>
+#include <mavros_msgs/PositionTarget.h>
 #include <geometry_msgs/PoseArray.h>
 #include <geometry_msgs/PoseStamped.h>
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
@@ -26,15 +27,28 @@ void ROSClient::init(DroneControl *const drone_control)
 {
   state_sub_ = nh_->subscribe<mavros_msgs::State>("/mavros/state", 10, &DroneControl::state_cb, drone_control);
   extended_state_sub_ = nh_->subscribe<mavros_msgs::ExtendedState>("/mavros/extended_state", 10, &DroneControl::extended_state_cb, drone_control);
-  marker_pos_sub_ = nh_->subscribe<geometry_msgs::PoseArray>("/whycon/poses", 10, &DroneControl::marker_position_cb, drone_control);
+  if(drone_control->marker_id_ < 0)
+  {
+    marker_pos_sub_ = nh_->subscribe<geometry_msgs::PoseArray>("/whycon/poses", 10, &DroneControl::marker_position_cb, drone_control);
+  }
+  else
+  {
+    // Poses and decoded IDs of the same image have the same stamp
+    marker_poses_filter_sub_ = new message_filters::Subscriber<geometry_msgs::PoseArray>(*nh_, "/whycon/poses", 10);
+    marker_ids_filter_sub_ = new message_filters::Subscriber<whycon::MarkerIds>(*nh_, "/whycon/ids", 10);
+    marker_sync_ = new message_filters::TimeSynchronizer<geometry_msgs::PoseArray, whycon::MarkerIds>(*marker_poses_filter_sub_, *marker_ids_filter_sub_, 10);
+    marker_sync_->registerCallback(boost::bind(&DroneControl::marker_ids_cb, drone_control, _1, _2));
+  }
   local_pos_sub_ = nh_->subscribe<geometry_msgs::PoseStamped>("/mavros/local_position/pose", 10, &DroneControl::local_position_cb, drone_control);
   global_pos_sub_ = nh_->subscribe<sensor_msgs::NavSatFix>("/mavros/global_position/global", 10, &DroneControl::global_position_cb, drone_control);
   svo_pos_sub_ = nh_->subscribe<geometry_msgs::PoseWithCovarianceStamped>("/svo/pose_imu", 10, &DroneControl::svo_position_cb, drone_control);
-  setpoint_pos_sub_ = nh_->subscribe<geometry_msgs::PoseStamped>("/trajectory/setpoint_position", 10, &DroneControl::setpoint_position_cb, drone_control);
+  trajectory_sub_ = nh_->subscribe<trajectory_planner::BSplineTrajectory>("/trajectory/bspline", 10, &DroneControl::trajectory_cb, drone_control);
 
   global_setpoint_pos_pub_ = nh_->advertise<mavros_msgs::GlobalPositionTarget>("/mavros/setpoint_position/global", 10);
   setpoint_pos_pub_ = nh_->advertise<geometry_msgs::PoseStamped>("/mavros/setpoint_position/local", 10);
+  setpoint_raw_pub_ = nh_->advertise<mavros_msgs::PositionTarget>("/mavros/setpoint_raw/local", 10);
   endpoint_pos_pub_ = nh_->advertise<geometry_msgs::PoseStamped>("/trajectory/endpoint_position", 10);
+  point_of_interest_pub_ = nh_->advertise<geometry_msgs::PointStamped>("/trajectory/point_of_interest", 10);
   vision_pos_pub_ = nh_->advertise<geometry_msgs::PoseStamped>("/mavros/vision_pose/pose", 10);
   svo_cmd_pub_ = nh_->advertise<std_msgs::String>("/svo/remote_key", 10);
   ewok_cmd_pub_ = nh_->advertise<std_msgs::String>("/trajectory/command", 10);
@@ -63,6 +77,15 @@ void ROSClient::publishTrajectoryEndpoint(const geometry_msgs::PoseStamped &setp
   }
 }
 
+void ROSClient::publishPointOfInterest(const geometry_msgs::PointStamped &point_ENU)
+{
+  // The planner keeps the point in the camera's field of view
+  if(avoidCollision_)
+  {
+    point_of_interest_pub_.publish(point_ENU);
+  }
+}
+
 void ROSClient::setParam(const std::string &key, double d)
 {
   nh_->setParam(key, d);
@@ -0,0 +1,79 @@
+#!/usr/bin/env python
+"""
+Converts a binary mission trace written by the MissionProfiler of
+offboard_control to the Chrome trace event format, which can be opened in
+chrome://tracing or https://ui.perfetto.dev
+
+Usage: trace_to_chrome.py offboard_control_trace.bin [trace.json]
+"""
+
+import json
+import struct
+import sys
+
+NAME, BEGIN, END, TIMEOUT, DATA_AGE = range(5)
+RECORD = struct.Struct('<BBHfq')
+
+
+def read_trace(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if data[:4] != b'MTRC':
+        raise ValueError('%s is not a mission trace' % path)
+    version, = struct.unpack_from('<I', data, 4)
+    if version != 1:
+        raise ValueError('Unsupported trace version %d' % version)
+
+    names = {}
+    events = []
+    offset = 8
+    while offset < len(data):
+        record_type = struct.unpack_from('<B', data, offset)[0]
+        if record_type == NAME:
+            length, name_id = struct.unpack_from('<BH', data, offset + 1)
+            names[name_id] = data[offset + 4:offset + 4 + length].decode('ascii')
+            offset += 4 + length
+        else:
+            if offset + RECORD.size > len(data):
+                break  # Truncated by a crash
+            record_type, _, name_id, value, stamp = RECORD.unpack_from(data, offset)
+            events.append((record_type, names.get(name_id, str(name_id)), value, stamp))
+            offset += RECORD.size
+
+    return events
+
+
+def to_chrome(events):
+    if not events:
+        return []
+
+    start = events[0][3]
+    chrome = []
+    for record_type, name, value, stamp in events:
+        ts = (stamp - start) / 1000.0  # Chrome traces use microseconds
+        if record_type == BEGIN:
+            chrome.append({'name': name, 'ph': 'B', 'ts': ts, 'pid': 0, 'tid': 0})
+        elif record_type == END:
+            chrome.append({'name': name, 'ph': 'E', 'ts': ts, 'pid': 0, 'tid': 0})
+        elif record_type == TIMEOUT:
+            chrome.append({'name': 'MAX_ATTEMPTS ' + name, 'ph': 'i', 's': 'g', 'ts': ts, 'pid': 0, 'tid': 0})
+        elif record_type == DATA_AGE:
+            chrome.append({'name': name + ' age', 'ph': 'C', 'ts': ts, 'pid': 0,
+                           'args': {'ms': value * 1000.0}})
+    return chrome
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+
+    output = sys.argv[2] if len(sys.argv) > 2 else sys.argv[1].rsplit('.', 1)[0] + '.json'
+    with open(output, 'w') as f:
+        json.dump({'traceEvents': to_chrome(read_trace(sys.argv[1])), 'displayTimeUnit': 'ms'}, f)
+    print('Wrote %s' % output)
+
+
+if __name__ == '__main__':
+    main()
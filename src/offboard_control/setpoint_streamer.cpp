@@ -0,0 +1,231 @@
+#include "include/setpoint_streamer.h"
+
+#include <algorithm>
+
+SetpointStreamer::SetpointStreamer(const ros::Publisher &setpoint_raw_pub)
+{
+  this->setpoint_raw_pub_ = setpoint_raw_pub;
+}
+
+SetpointStreamer::~SetpointStreamer()
+{
+  stop();
+}
+
+void SetpointStreamer::start(const geometry_msgs::PoseStamped &initial_pose)
+{
+  if(isRunning()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Hold the initial pose until the first target arrives
+    tf::pointMsgToTF(initial_pose.pose.position, target_pos_);
+    target_yaw_ = tf::getYaw(initial_pose.pose.orientation);
+
+    transition_.start = ros::Time::now();
+    transition_.duration = MIN_TRANSITION_TIME;
+    for(int i = 0; i < 3; ++i)
+    {
+      std::fill(transition_.coeffs[i], transition_.coeffs[i] + 6, 0.0);
+      transition_.coeffs[i][0] = target_pos_[i];
+    }
+
+    running_ = true;
+  }
+
+  thread_ = std::thread(&SetpointStreamer::run, this);
+  ROS_INFO("Setpoint streamer started at %.0f Hz", STREAM_RATE);
+}
+
+void SetpointStreamer::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!running_) return;
+    running_ = false;
+  }
+
+  if(thread_.joinable()) thread_.join();
+  ROS_INFO("Setpoint streamer stopped");
+}
+
+bool SetpointStreamer::isRunning() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return running_;
+}
+
+void SetpointStreamer::setTarget(const geometry_msgs::PoseStamped &target)
+{
+  tf::Vector3 p1;
+  tf::pointMsgToTF(target.pose.position, p1);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ros::Time now = ros::Time::now();
+
+  // The planner is in charge as long as it keeps sending trajectories
+  if(followingTrajectory(now)) return;
+
+  target_yaw_ = tf::getYaw(target.pose.orientation);
+
+  // The behaviours republish the same target every cycle, only replan on change
+  if(!trajectory_ && p1.distance(target_pos_) < TARGET_TOLERANCE) return;
+  target_pos_ = p1;
+
+  // Start from the current reference state so that the setpoints stay continuous
+  tf::Vector3 p0, v0, a0;
+  evaluate(now, p0, v0, a0);
+  trajectory_.reset();
+
+  // A rest-to-rest minimum-jerk transition peaks at 1.875 times the mean velocity
+  double T = std::max((double)MIN_TRANSITION_TIME, 1.875 * p1.distance(p0) / MAX_VELOCITY);
+  double T2 = T*T, T3 = T2*T, T4 = T3*T, T5 = T4*T;
+
+  transition_.start = now;
+  transition_.duration = T;
+  for(int i = 0; i < 3; ++i)
+  {
+    double d = p1[i] - p0[i];
+    double *c = transition_.coeffs[i];
+    c[0] = p0[i];
+    c[1] = v0[i];
+    c[2] = a0[i] / 2;
+    c[3] = (20*d - 12*v0[i]*T - 3*a0[i]*T2) / (2*T3);
+    c[4] = (-30*d + 16*v0[i]*T + 3*a0[i]*T2) / (2*T4);
+    c[5] = (12*d - 6*v0[i]*T - a0[i]*T2) / (2*T5);
+  }
+}
+
+void SetpointStreamer::setTrajectory(const ros::Time &start, const Spline::Ptr &spline, double yaw)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  trajectory_ = spline;
+  trajectory_start_ = start;
+  trajectory_received_ = ros::Time::now();
+  target_yaw_ = yaw;
+}
+
+SetpointStreamer::Spline::Ptr SetpointStreamer::makeSpline(const trajectory_planner::BSplineTrajectory &msg)
+{
+  if(msg.order != Spline::N || msg.dt <= 0 || (int)msg.control_points.size() < Spline::minWindowSize())
+  {
+    ROS_WARN("Ignoring trajectory of order %d with %zu control points", msg.order, msg.control_points.size());
+    return Spline::Ptr();
+  }
+
+  Spline::Ptr spline(new Spline(msg.dt));
+  for(const geometry_msgs::Point &cp : msg.control_points)
+  {
+    spline->push_back(Spline::Vector3(cp.x, cp.y, cp.z));
+  }
+
+  // Without a yaw spline the trajectory is flown with the single heading
+  if(msg.yaw_control_points.size() == msg.control_points.size())
+  {
+    for(double yaw : msg.yaw_control_points)
+    {
+      spline->pushYaw(yaw);
+    }
+  }
+
+  return spline;
+}
+
+bool SetpointStreamer::followingTrajectory(const ros::Time &time) const
+{
+  return trajectory_ && time - trajectory_received_ < ros::Duration(TRAJECTORY_TIMEOUT);
+}
+
+void SetpointStreamer::evaluate(const ros::Time &time, tf::Vector3 &pos, tf::Vector3 &vel, tf::Vector3 &acc) const
+{
+  if(trajectory_)
+  {
+    double t = (time - trajectory_start_).toSec();
+    Spline::Vector3 p = trajectory_->evaluate(t, 0);
+    pos.setValue(p[0], p[1], p[2]);
+
+    // Hold the end of the trajectory at rest if the planner stops sending
+    if(t >= trajectory_->duration())
+    {
+      vel.setZero();
+      acc.setZero();
+    }
+    else
+    {
+      Spline::Vector3 v = trajectory_->evaluate(t, 1);
+      Spline::Vector3 a = trajectory_->evaluate(t, 2);
+      vel.setValue(v[0], v[1], v[2]);
+      acc.setValue(a[0], a[1], a[2]);
+    }
+    return;
+  }
+
+  double t = (time - transition_.start).toSec();
+  t = std::min(std::max(t, 0.0), transition_.duration);
+
+  for(int i = 0; i < 3; ++i)
+  {
+    const double *c = transition_.coeffs[i];
+    pos[i] = c[0] + t*(c[1] + t*(c[2] + t*(c[3] + t*(c[4] + t*c[5]))));
+    vel[i] = c[1] + t*(2*c[2] + t*(3*c[3] + t*(4*c[4] + t*5*c[5])));
+    acc[i] = 2*c[2] + t*(6*c[3] + t*(12*c[4] + t*20*c[5]));
+  }
+
+  // Hold the target at rest once the transition is finished
+  if(t >= transition_.duration)
+  {
+    vel.setZero();
+    acc.setZero();
+  }
+}
+
+void SetpointStreamer::fillMessage(const ros::Time &time, mavros_msgs::PositionTarget &msg) const
+{
+  tf::Vector3 pos, vel, acc;
+  evaluate(time, pos, vel, acc);
+
+  msg.header.stamp = time;
+  msg.header.frame_id = "world";
+  msg.coordinate_frame = mavros_msgs::PositionTarget::FRAME_LOCAL_NED; // mavros converts from ENU
+  msg.type_mask = mavros_msgs::PositionTarget::IGNORE_YAW_RATE;
+  msg.yaw = target_yaw_;
+
+  // Turn while translating along a planned yaw, with its rate as feed forward
+  if(trajectory_ && trajectory_->hasYaw())
+  {
+    double t = (time - trajectory_start_).toSec();
+    msg.type_mask = 0;
+    msg.yaw = trajectory_->evaluateYaw(t, 0);
+    msg.yaw_rate = t < trajectory_->duration() ? trajectory_->evaluateYaw(t, 1) : 0;
+  }
+
+  msg.position.x = pos.x();
+  msg.position.y = pos.y();
+  msg.position.z = pos.z();
+  msg.velocity.x = vel.x();
+  msg.velocity.y = vel.y();
+  msg.velocity.z = vel.z();
+  msg.acceleration_or_force.x = acc.x();
+  msg.acceleration_or_force.y = acc.y();
+  msg.acceleration_or_force.z = acc.z();
+}
+
+void SetpointStreamer::run()
+{
+  // The setpoint publishing rate MUST be faster than 2Hz
+  ros::Rate rate(STREAM_RATE);
+  mavros_msgs::PositionTarget msg;
+
+  while(ros::ok())
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(!running_) break;
+      fillMessage(ros::Time::now(), msg);
+    }
+    setpoint_raw_pub_.publish(msg);
+    rate.sleep();
+  }
+}
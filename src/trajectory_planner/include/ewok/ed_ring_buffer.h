@@ -52,7 +52,9 @@ class EuclideanDistanceRingBuffer {
       truncation_distance_(truncation_distance),
       occupancy_buffer_(resolution),
       tmp_buffer1_(resolution), tmp_buffer2_(resolution),
-      distance_buffer_(resolution, truncation_distance) {
+      tmp_inside_buffer1_(resolution), tmp_inside_buffer2_(resolution),
+      distance_buffer_(resolution, truncation_distance),
+      version_(0) {
 
     distance_buffer_.setEmptyElement(std::numeric_limits<_Scalar>::max());
 
@@ -74,18 +76,33 @@ class EuclideanDistanceRingBuffer {
     compute_edt3d();
   }
 
-  void insertPointCloud(const PointCloud &cloud, const Vector3 &origin) {
-    occupancy_buffer_.insertPointCloud(cloud, origin);
+  void insertPointCloud(const PointCloud &cloud, const Vector3 &origin, _Scalar max_range = 0) {
+    occupancy_buffer_.insertPointCloud(cloud, origin, max_range);
+  }
+
+  void setDecayHalfLife(double half_life, int slices_per_update = 4) {
+    occupancy_buffer_.setDecayHalfLife(half_life, slices_per_update);
+  }
+
+  void updateDecay(double time) {
+    occupancy_buffer_.updateDecay(time);
   }
 
   virtual void setOffset(const Vector3i &off) {
     occupancy_buffer_.setOffset(off);
     distance_buffer_.setOffset(off);
+    version_++;
   }
 
   virtual void moveVolume(const Vector3i &direction) {
     occupancy_buffer_.moveVolume(direction);
     distance_buffer_.moveVolume(direction);
+    version_++;
+  }
+
+  // Changes whenever distances may have changed, lets users cache queries
+  inline uint64_t getVersion() const {
+    return version_;
   }
 
   void getMarkerFree(visualization_msgs::Marker & m)  {
@@ -177,6 +194,17 @@ class EuclideanDistanceRingBuffer {
 
   }
 
+  // Batched version of getDistanceWithGrad
+  template<class Vector3Array, class ScalarArray>
+  void getDistancesWithGrad(const Vector3Array & points, ScalarArray & distances, Vector3Array & grads) {
+    distances.resize(points.size());
+    grads.resize(points.size());
+
+    for(size_t i = 0; i < points.size(); i++) {
+      distances[i] = getDistanceWithGrad(points[i], grads[i]);
+    }
+  }
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  protected:
@@ -190,6 +218,9 @@ class EuclideanDistanceRingBuffer {
     Vector3i min_vec, max_vec;
     occupancy_buffer_.getUpdatedMinMax(min_vec, max_vec);
 
+    if((min_vec.array() > max_vec.array()).any()) return;
+    version_++;
+
     min_vec -= offset;
     max_vec -= offset;
 
@@ -201,12 +232,20 @@ class EuclideanDistanceRingBuffer {
 
     //ROS_INFO_STREAM("min_vec: " << min_vec.transpose() << " max_vec: " << max_vec.transpose());
 
+    // The distance to the closest occupied voxel is computed for free voxels and
+    // the distance to the closest free voxel for occupied ones, in the same sweeps.
+    // Inside obstacles the distance is negative (0 on their surface), so that the
+    // gradient still points out of them.
     for(int x=min_vec[0]; x<=max_vec[0]; x++) {
       for(int y=min_vec[1]; y<=max_vec[1]; y++) {
 
         fill_edt([&](int z) {return occupancy_buffer_.isOccupied(offset + Vector3i(x,y,z)) ? 0 : std::numeric_limits<_Scalar>::max();},
                  [&](int z, _Scalar val) {tmp_buffer1_.at(Vector3i(x,y,z)) = val;},
                  min_vec[2], max_vec[2]);
+
+        fill_edt([&](int z) {return occupancy_buffer_.isOccupied(offset + Vector3i(x,y,z)) ? std::numeric_limits<_Scalar>::max() : 0;},
+                 [&](int z, _Scalar val) {tmp_inside_buffer1_.at(Vector3i(x,y,z)) = val;},
+                 min_vec[2], max_vec[2]);
       }
     }
 
@@ -216,14 +255,26 @@ class EuclideanDistanceRingBuffer {
         fill_edt([&](int y) {return tmp_buffer1_.at(Vector3i(x,y,z));},
                  [&](int y, _Scalar val) {tmp_buffer2_.at(Vector3i(x,y,z)) = val;},
                  min_vec[1], max_vec[1]);
+
+        fill_edt([&](int y) {return tmp_inside_buffer1_.at(Vector3i(x,y,z));},
+                 [&](int y, _Scalar val) {tmp_inside_buffer2_.at(Vector3i(x,y,z)) = val;},
+                 min_vec[1], max_vec[1]);
       }
     }
 
 
     for(int y=min_vec[1]; y<=max_vec[1]; y++) {
       for(int z=min_vec[2]; z<=max_vec[2]; z++) {
+        fill_edt([&](int x) {return tmp_inside_buffer2_.at(Vector3i(x,y,z));},
+                 [&](int x, _Scalar val) {tmp_inside_buffer1_.at(Vector3i(x,y,z)) = val;},
+                 min_vec[0], max_vec[0]);
+
+        // Squared distance to the closest occupied voxel is 0 only for occupied voxels
         fill_edt([&](int x) {return tmp_buffer2_.at(Vector3i(x,y,z));},
-                 [&](int x, _Scalar val) { distance_buffer_.at(offset + Vector3i(x,y,z)) = std::min(resolution_ * std::sqrt(val), truncation_distance_);},
+                 [&](int x, _Scalar val) {
+                   distance_buffer_.at(offset + Vector3i(x,y,z)) = val > 0 ?
+                       std::min(resolution_ * std::sqrt(val), truncation_distance_) :
+                       -std::min(resolution_ * (std::sqrt(tmp_inside_buffer1_.at(Vector3i(x,y,z))) - 1), truncation_distance_);},
                  min_vec[0], max_vec[0]);
       }
     }
@@ -283,6 +334,9 @@ class EuclideanDistanceRingBuffer {
   RingBufferBase <_POW, _Scalar, _Scalar> distance_buffer_;
 
   RingBufferBase <_POW, _Scalar, _Scalar> tmp_buffer1_, tmp_buffer2_;
+  RingBufferBase <_POW, _Scalar, _Scalar> tmp_inside_buffer1_, tmp_inside_buffer2_;
+
+  uint64_t version_;
 
 };
 
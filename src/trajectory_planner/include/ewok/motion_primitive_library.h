@@ -0,0 +1,268 @@
+/**
+* This file is part of Ewok.
+*
+* Copyright 2017 Vladyslav Usenko, Technical University of Munich.
+* Developed by Vladyslav Usenko <vlad dot usenko at tum dot de>,
+* for more information see <http://vision.in.tum.de/research/robotvision/replanning>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* Ewok is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* Ewok is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with Ewok. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EWOK_OPTIMIZATION_INCLUDE_EWOK_MOTION_PRIMITIVE_LIBRARY_H_
+#define EWOK_OPTIMIZATION_INCLUDE_EWOK_MOTION_PRIMITIVE_LIBRARY_H_
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ewok {
+
+// Library of motion primitives used as initial guesses of the spline optimization.
+// A primitive is a fixed sequence of control point offsets from the start point,
+// given in a frame whose x axis points towards the goal and whose y axis is
+// horizontal, so that steep and vertical goals are reached as well. Primitives
+// leave the start with a heading and climb angle relative to the goal direction
+// and turn back towards it, at one of several speeds.
+//
+// Libraries are generated offline (see motion_primitive_generator) and stored as
+//   char[4] "EWMP", uint32 version, uint32 num_primitives, uint32 num_control_points,
+//   float32 dt, float32[num_primitives][num_control_points][3] offsets
+template<typename _Scalar = double>
+class MotionPrimitiveLibrary {
+ public:
+
+  typedef std::shared_ptr<MotionPrimitiveLibrary<_Scalar>> Ptr;
+
+  typedef Eigen::Matrix<_Scalar, 3, 1> Vector3;
+  typedef Eigen::Matrix<_Scalar, 3, 3> Matrix3;
+  typedef std::vector<Vector3, Eigen::aligned_allocator<Vector3>> Vector3Array;
+
+  static const uint32_t version = 1;
+
+  MotionPrimitiveLibrary() : num_control_points_(0), dt_(0), collision_weight_(100), samples_per_segment_(4) {
+  }
+
+  // Angles in radians, speeds in m/s. The control points of a primitive advance
+  // by speed * dt each, the direction turns linearly from the initial heading and
+  // climb angle back to the goal direction over the primitive.
+  void generate(_Scalar dt, int num_control_points,
+                const std::vector<_Scalar> & headings,
+                const std::vector<_Scalar> & climb_angles,
+                const std::vector<_Scalar> & speeds) {
+    dt_ = dt;
+    num_control_points_ = num_control_points;
+    offsets_.clear();
+
+    for (_Scalar speed : speeds) {
+      for (_Scalar climb : climb_angles) {
+        for (_Scalar heading : headings) {
+          Vector3 p = Vector3::Zero();
+
+          for (int i = 0; i < num_control_points; i++) {
+            _Scalar alpha = num_control_points > 1 ? _Scalar(1) - _Scalar(i) / (num_control_points - 1) : 1;
+            _Scalar h = alpha * heading, c = alpha * climb;
+
+            p += speed * dt * Vector3(std::cos(c) * std::cos(h), std::cos(c) * std::sin(h), std::sin(c));
+            offsets_.push_back(p);
+          }
+        }
+      }
+    }
+  }
+
+  bool save(const std::string & filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) return false;
+
+    uint32_t header[3] = {version, numPrimitives(), num_control_points_};
+    float dt = dt_;
+
+    file.write("EWMP", 4);
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(&dt), sizeof(dt));
+
+    for (const Vector3 & offset : offsets_) {
+      Eigen::Vector3f o = offset.template cast<float>();
+      file.write(reinterpret_cast<const char *>(o.data()), 3 * sizeof(float));
+    }
+
+    return bool(file);
+  }
+
+  bool load(const std::string & filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+
+    char magic[4];
+    uint32_t header[3];
+    float dt;
+
+    file.read(magic, 4);
+    file.read(reinterpret_cast<char *>(header), sizeof(header));
+    file.read(reinterpret_cast<char *>(&dt), sizeof(dt));
+
+    if (!file || std::string(magic, 4) != "EWMP" || header[0] != version) return false;
+
+    std::vector<float> data(3 * header[1] * header[2]);
+    file.read(reinterpret_cast<char *>(data.data()), data.size() * sizeof(float));
+    if (!file) return false;
+
+    num_control_points_ = header[2];
+    dt_ = dt;
+    offsets_.resize(header[1] * header[2]);
+
+    for (size_t i = 0; i < offsets_.size(); i++) {
+      offsets_[i] = Vector3(data[3*i], data[3*i + 1], data[3*i + 2]);
+    }
+
+    return true;
+  }
+
+  inline uint32_t numPrimitives() const {
+    return num_control_points_ > 0 ? offsets_.size() / num_control_points_ : 0;
+  }
+
+  inline uint32_t numControlPoints() const {
+    return num_control_points_;
+  }
+
+  inline _Scalar dt() const {
+    return dt_;
+  }
+
+  // Weight of the squared penetration of the distance threshold relative to the
+  // remaining distance to the goal
+  void setCollisionWeight(_Scalar w) {
+    collision_weight_ = w;
+  }
+
+  // Control points of a primitive placed at start and turned towards goal.
+  // Primitives which would pass the goal are shrunk to end at its distance.
+  void getControlPoints(int primitive, const Vector3 & start, const Vector3 & goal, Vector3Array & cps) const {
+    Vector3 diff = goal - start;
+    Matrix3 R = Matrix3::Identity();
+
+    if (diff.norm() > std::numeric_limits<_Scalar>::epsilon()) {
+      // Around a vertical goal direction the horizontal y axis is arbitrary
+      Vector3 x = diff.normalized();
+      Vector3 y = Vector3::UnitZ().cross(x);
+      y = y.norm() > 1e-6 ? y.normalized() : Vector3::UnitY();
+
+      R.col(0) = x;
+      R.col(1) = y;
+      R.col(2) = x.cross(y);
+    }
+
+    const Vector3 * offsets = &offsets_[primitive * num_control_points_];
+    _Scalar length = offsets[num_control_points_ - 1].norm();
+    _Scalar scale = length > diff.norm() ? diff.norm() / length : 1;
+
+    cps.resize(num_control_points_);
+    for (uint32_t i = 0; i < num_control_points_; i++) {
+      cps[i] = start + scale * (R * offsets[i]);
+    }
+  }
+
+  // Number of points checked on every edge of the control polygon
+  void setSamplesPerSegment(int n) {
+    samples_per_segment_ = n;
+  }
+
+  // Scores all primitives with one batched distance query along their control
+  // polygons and returns the best one. The score is the remaining distance to the
+  // goal plus the weighted squared penetration of the distance threshold, which
+  // the B-spline (within the convex hull of its control points) approximately
+  // shares. Keeping all control points at the start is scored the same way and
+  // wins ties; -1 is returned if no primitive beats it or the library is empty,
+  // and best_cps is left unchanged.
+  template<class _DistanceProvider>
+  int selectBest(_DistanceProvider & distance_provider, const Vector3 & start, const Vector3 & goal,
+                 _Scalar distance_threshold, Vector3Array & best_cps) const {
+    uint32_t n = numPrimitives();
+    if (n == 0) return -1;
+
+    uint32_t num_samples = num_control_points_ * samples_per_segment_;
+
+    // The start point seed is the last query point, standing in for num_samples
+    // samples of its collapsed control polygon
+    points_.resize(n * num_samples + 1);
+    points_.back() = start;
+
+    Vector3Array cps;
+    for (uint32_t i = 0; i < n; i++) {
+      getControlPoints(i, start, goal, cps);
+
+      for (uint32_t j = 0; j < num_control_points_; j++) {
+        Vector3 previous = j > 0 ? cps[j - 1] : start;
+        for (int k = 0; k < samples_per_segment_; k++) {
+          _Scalar alpha = _Scalar(k + 1) / samples_per_segment_;
+          points_[i * num_samples + j * samples_per_segment_ + k] = previous + alpha * (cps[j] - previous);
+        }
+      }
+    }
+
+    distance_provider.getDistancesWithGrad(points_, distances_, grads_);
+
+    auto collision_score = [&](uint32_t j) {
+      _Scalar penetration = std::max(distance_threshold - _Scalar(distances_[j]), _Scalar(0));
+      return collision_weight_ * penetration * penetration / distance_threshold;
+    };
+
+    int best = -1;
+    _Scalar best_score = (start - goal).norm() + num_samples * collision_score(n * num_samples);
+
+    for (uint32_t i = 0; i < n; i++) {
+      _Scalar score = (points_[(i + 1) * num_samples - 1] - goal).norm();
+
+      for (uint32_t j = i * num_samples; j < (i + 1) * num_samples; j++) {
+        score += collision_score(j);
+      }
+
+      if (score < best_score) {
+        best_score = score;
+        best = i;
+      }
+    }
+
+    if (best >= 0) getControlPoints(best, start, goal, best_cps);
+    return best;
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ protected:
+  uint32_t num_control_points_;
+  _Scalar dt_;
+  _Scalar collision_weight_;
+  int samples_per_segment_;
+
+  Vector3Array offsets_;
+
+  // Scratch space of selectBest, reused between calls
+  mutable Vector3Array points_, grads_;
+  mutable std::vector<_Scalar> distances_;
+};
+
+}  // namespace ewok
+
+#endif  // EWOK_OPTIMIZATION_INCLUDE_EWOK_MOTION_PRIMITIVE_LIBRARY_H_
@@ -63,6 +63,26 @@ class PolynomialSegment3D {
                    polynomials_[2].evaluate(t, derivative));
   }
 
+  // Upper bound of the speed on the segment, from the absolute values of the
+  // coefficients of the derivative
+  _Scalar maxVelocityBound() const {
+    Vector3 bound;
+    typename Pol::VectorN coeffs;
+
+    for (int i = 0; i < 3; i++) {
+      polynomials_[i].getCoeffs(coeffs);
+
+      bound[i] = 0;
+      _Scalar tp = 1;
+      for (int k = 1; k < _N; k++) {
+        bound[i] += k * std::abs(coeffs[k]) * tp;
+        tp *= segment_time_;
+      }
+    }
+
+    return bound.norm();
+  }
+
   template<class Derived>
   void getDerivatives(_Scalar t,
                       const Eigen::MatrixBase <Derived> &x_const,
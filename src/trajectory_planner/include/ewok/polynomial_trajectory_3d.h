@@ -67,6 +67,41 @@ class PolynomialTrajectory3D {
       return _segments[seg_num]->evaluate(lt, derivative);
   }
 
+  // Sphere tracing along the trajectory: the trajectory cannot get closer than
+  // min_distance to an obstacle before (distance - min_distance) / max speed,
+  // which bounds the next step. The speed is bounded per segment, the distance
+  // field is assumed to be 1-Lipschitz and steps are at least min_step long.
+  // Returns the first time in [t_start, t_end] closer than min_distance to an
+  // obstacle, or a negative value if there is none.
+  template<class _DistanceProvider>
+  _Scalar checkTrajectory(_DistanceProvider & distance_provider, _Scalar min_distance,
+                          _Scalar t_start, _Scalar t_end, _Scalar min_step = 0.01) const {
+      t_start = std::max(t_start, _Scalar(0));
+      t_end = std::min(t_end, duration());
+
+      Vector3 point, grad;
+
+      for (size_t i = 0; i < _segments.size(); i++) {
+          _Scalar segment_start = _cumulative_time[i], segment_end = _cumulative_time[i + 1];
+          if (segment_end < t_start || segment_start > t_end) continue;
+
+          _Scalar max_velocity = _segments[i]->maxVelocityBound();
+          _Scalar t = std::max(t_start, segment_start);
+
+          while (t <= std::min(t_end, segment_end)) {
+              point = _segments[i]->evaluate(t - segment_start, 0);
+              _Scalar distance = distance_provider.getDistanceWithGrad(point, grad);
+
+              if (distance < min_distance) return t;
+
+              t += max_velocity > 0 ? std::max((distance - min_distance) / max_velocity, min_step)
+                                    : segment_end - segment_start + min_step;
+          }
+      }
+
+      return -1;
+  }
+
   void getVisualizationMarkerArray(visualization_msgs::MarkerArray &traj_marker_array,
                                    const std::string &ns,
                                    const Eigen::Vector3d &color,
@@ -27,6 +27,8 @@
 
 #include <ewok/ring_buffer_base.h>
 
+#include <cmath>
+#include <memory>
 #include <vector>
 
 namespace ewok {
@@ -72,7 +74,9 @@ class RaycastRingBuffer {
   RaycastRingBuffer(const _Scalar &resolution) :
       resolution_(resolution),
       occupancy_buffer_(resolution, _Datatype(0)),
-      flag_buffer_(resolution, _Flag(0)) {
+      flag_buffer_(resolution, _Flag(0)),
+      decay_half_life_(0), decay_slices_per_update_(1),
+      decay_slice_(0), decay_time_(0), decay_time_origin_(0), decay_time_set_(false) {
 
     flag_buffer_.setEmptyElement(updated_flag);
     clearUpdatedMinMax();
@@ -108,7 +112,75 @@ class RaycastRingBuffer {
     updated_max_ = offset;
   }
 
-  void insertPointCloud(const PointCloud &cloud, const Vector3 &origin) {
+  // Pulls the occupancy of voxels that are not observed anymore back towards
+  // unknown, halving it every half_life seconds. Voxels are decayed lazily when
+  // they are touched by an insertion, and slices_per_update x-slices of the
+  // volume are swept on every call of updateDecay. A half-life of 0 disables
+  // decay and releases the per-voxel time stamps.
+  void setDecayHalfLife(double half_life, int slices_per_update = 4) {
+    decay_half_life_ = half_life;
+    decay_slices_per_update_ = std::max(1, std::min(slices_per_update, _N));
+
+    if (half_life <= 0) {
+      stamp_buffer_.reset();
+      return;
+    }
+
+    if (!stamp_buffer_) {
+      Vector3i offset;
+      occupancy_buffer_.getOffset(offset);
+
+      stamp_buffer_.reset(new RingBufferBase<_POW, float, _Scalar>(resolution_, 0.0f));
+      stamp_buffer_->setOffset(offset);
+      decay_time_origin_ = decay_time_;
+    }
+  }
+
+  // Sets the time in seconds used for decay and stamping of the following
+  // insertions and decays the next slices of the volume.
+  void updateDecay(double time) {
+    if (!decay_time_set_) {
+      decay_time_origin_ = time;
+      decay_time_set_ = true;
+    }
+
+    decay_time_ = time;
+
+    if (!stamp_buffer_) return;
+
+    Vector3i offset;
+    occupancy_buffer_.getOffset(offset);
+
+    for (int i = 0; i < decay_slices_per_update_; ++i) {
+      int x = offset(0) + decay_slice_;
+      decay_slice_ = (decay_slice_ + 1) % _N;
+
+      for (int y = offset(1); y < offset(1) + _N; ++y) {
+        for (int z = offset(2); z < offset(2) + _N; ++z) {
+
+          Vector3i idx(x, y, z);
+
+          _Datatype & occupancy_data = occupancy_buffer_.at(idx);
+
+          bool was_occupied = isOccupied(occupancy_data);
+          decay(idx);
+          bool is_occupied = isOccupied(occupancy_data);
+
+          if (was_occupied != is_occupied) {
+            flag_buffer_.at(idx) |= updated_flag;
+
+            updated_min_ = updated_min_.array().min(idx.array());
+            updated_max_ = updated_max_.array().max(idx.array());
+          }
+        }
+      }
+    }
+  }
+
+  // Points further than max_range from the origin only clear the free space
+  // up to max_range and are not inserted as hits, 0 disables the limit.
+  // Rays are truncated to the range and the volume before they are traversed.
+  void insertPointCloud(const PointCloud &cloud, const Vector3 &origin, _Scalar max_range = 0) {
 
     Vector3i origin_idx;
     occupancy_buffer_.getIdx(origin, origin_idx);
@@ -127,11 +199,23 @@ class RaycastRingBuffer {
     // and mark for inserting a free ray
     for (const Vector4 &vec : cloud) {
       Vector3 v = vec.template head<3>();
+      _Flag endpoint_flag = occupied_flag;
+
+      if (max_range > 0) {
+        Vector3 diff = v - origin;
+        _Scalar range = diff.norm();
+
+        if (range > max_range) {
+          v = origin + diff * (max_range / range);
+          endpoint_flag = free_ray_flag;
+        }
+      }
+
       Vector3i idx;
       occupancy_buffer_.getIdx(v, idx);
 
       if (occupancy_buffer_.insideVolume(idx)) {
-        flag_buffer_.at(idx) |= occupied_flag;
+        flag_buffer_.at(idx) |= endpoint_flag;
 
       } else {
         Vector3 p;
@@ -171,6 +255,7 @@ class RaycastRingBuffer {
             _Datatype & occupancy_data = occupancy_buffer_.at(idx);
 
             bool was_occupied = isOccupied(occupancy_data);
+            if (stamp_buffer_) decay(idx);
             addHit(occupancy_data);
             bool is_occupied = isOccupied(occupancy_data);
 
@@ -188,6 +273,7 @@ class RaycastRingBuffer {
             _Datatype & occupancy_data = occupancy_buffer_.at(idx);
 
             bool was_occupied = isOccupied(occupancy_data);
+            if (stamp_buffer_) decay(idx);
             addMiss(occupancy_data);
             bool is_occupied =  isOccupied(occupancy_data);
             flag_buffer_.at(idx) &= ~insertion_flags;
@@ -207,11 +293,13 @@ class RaycastRingBuffer {
   virtual void setOffset(const Vector3i &off) {
     occupancy_buffer_.setOffset(off);
     flag_buffer_.setOffset(off);
+    if (stamp_buffer_) stamp_buffer_->setOffset(off);
   }
 
   virtual void moveVolume(const Vector3i &direction) {
     occupancy_buffer_.moveVolume(direction);
     flag_buffer_.moveVolume(direction);
+    if (stamp_buffer_) stamp_buffer_->moveVolume(direction);
 
     Vector3i offset;
     occupancy_buffer_.getOffset(offset);
@@ -283,6 +371,20 @@ class RaycastRingBuffer {
     d = occ;
   }
 
+  // Decays the voxel from its stamp to the current time and restamps it
+  inline void decay(const Vector3i & idx) {
+    float & stamp = stamp_buffer_->at(idx);
+    _Datatype & d = occupancy_buffer_.at(idx);
+
+    float now = decay_time_ - decay_time_origin_;
+
+    if (d != 0 && now > stamp) {
+      d = static_cast<_Datatype>(d * std::exp2((stamp - now) / decay_half_life_));
+    }
+
+    stamp = now;
+  }
+
   static inline bool isOccupied(const _Datatype & d) {
     return d > datatype_hit;
   }
@@ -433,6 +535,17 @@ class RaycastRingBuffer {
   // buffer to store insertion information
   RingBufferBase <_POW, _Flag, _Scalar> flag_buffer_;
 
+  // time of the last decay or insertion of every voxel, only allocated if decay is enabled
+  std::unique_ptr<RingBufferBase <_POW, float, _Scalar>> stamp_buffer_;
+
+  double decay_half_life_;
+  int decay_slices_per_update_;
+  int decay_slice_;
+
+  // stamps are relative to decay_time_origin_, so that they fit into a float
+  double decay_time_, decay_time_origin_;
+  bool decay_time_set_;
+
 };
 
 }
@@ -241,7 +241,7 @@ class UniformBSpline {
     return maxValidIdx() * dt_;
   }
 
-  inline int size() {
+  inline int size() const {
     return control_points_.size();
   }
 
@@ -263,7 +263,7 @@ class UniformBSpline {
   std::array<_Scalar, 2 * _N> pow_inv_dt_;
 };
 
-uint64_t C_n_k(uint64_t n, uint64_t k) {
+inline uint64_t C_n_k(uint64_t n, uint64_t k) {
   if (k > n) {
     return 0;
   }
@@ -160,11 +160,11 @@ class UniformBSpline3D {
     }
   }
 
-  inline int size() {
+  inline int size() const {
     return splines_[0].size();
   }
 
-  inline Vector3 getControlPoint(int i) {
+  inline Vector3 getControlPoint(int i) const {
     return Vector3(splines_[0].coeff(i),
                    splines_[1].coeff(i),
                    splines_[2].coeff(i));
@@ -206,6 +206,43 @@ class UniformBSpline3D {
     return dt_;
   }
 
+  // Sphere tracing along the spline: the spline cannot get closer than
+  // min_distance to an obstacle before (distance - min_distance) / max speed,
+  // which bounds the next step. The speed is bounded by the differences of the
+  // control points the interval depends on, the distance field is assumed to be
+  // 1-Lipschitz and steps are at least min_step long.
+  // Returns the first time in [t_start, t_end] closer than min_distance to an
+  // obstacle, or a negative value if there is none.
+  template<class _DistanceProvider>
+  _Scalar checkTrajectory(_DistanceProvider & distance_provider, _Scalar min_distance,
+                          _Scalar t_start, _Scalar t_end, _Scalar min_step = 0.01) const {
+    t_start = std::max(t_start, minValidTime());
+    t_end = std::min(t_end, maxValidTime());
+
+    // The derivative is a spline with the scaled differences as control points
+    int min_idx = std::max(static_cast<int>(t_start / dt_) - OFFSET, 0);
+    int max_idx = std::min(static_cast<int>(t_end / dt_) - OFFSET + _N - 1, size() - 1);
+
+    _Scalar max_velocity = 0;
+    for (int i = min_idx; i < max_idx; i++) {
+      max_velocity = std::max(max_velocity, (getControlPoint(i + 1) - getControlPoint(i)).norm() / dt_);
+    }
+
+    Vector3 point, grad;
+
+    for (_Scalar t = t_start; t <= t_end;) {
+      point = evaluate(t, 0);
+      _Scalar distance = distance_provider.getDistanceWithGrad(point, grad);
+
+      if (distance < min_distance) return t;
+      if (max_velocity <= 0) break;
+
+      t += std::max((distance - min_distance) / max_velocity, min_step);
+    }
+
+    return -1;
+  }
+
 
   void getVisualizationMarker(visualization_msgs::Marker & traj_marker, const std::string & ns,
                               int id, const Eigen::Vector3d & color, int fixed_id = -_N, int num_points = 0,
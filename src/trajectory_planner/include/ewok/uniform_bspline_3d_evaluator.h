@@ -0,0 +1,113 @@
+/**
+* This file is part of Ewok.
+*
+* Copyright 2017 Vladyslav Usenko, Technical University of Munich.
+* Developed by Vladyslav Usenko <vlad dot usenko at tum dot de>,
+* for more information see <http://vision.in.tum.de/research/robotvision/replanning>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* Ewok is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* Ewok is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with Ewok. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EWOK_POLY_SPLINE_INCLUDE_EWOK_UNIFORM_BSPLINE_3D_EVALUATOR_H_
+#define EWOK_POLY_SPLINE_INCLUDE_EWOK_UNIFORM_BSPLINE_3D_EVALUATOR_H_
+
+#include <Eigen/Dense>
+
+#include <ewok/uniform_bspline.h>
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+namespace ewok {
+
+// Evaluates a window of control points of a UniformBSpline3D, e.g. one
+// received from the planner. Time is measured from the start of the first
+// valid segment of the window and clamped to the valid range, so the window
+// can be sampled at any rate without access to the full spline.
+// An optional yaw spline with the same knots can be attached.
+// Only depends on Eigen and does not pull in any ROS headers.
+template<int _N, typename _Scalar = double>
+class UniformBSpline3DEvaluator {
+ public:
+  static const int N = _N;
+  static const int OFFSET = N / 2 - 1;
+
+  typedef std::shared_ptr<UniformBSpline3DEvaluator<_N, _Scalar>> Ptr;
+
+  typedef Eigen::Matrix<_Scalar, 3, 1> Vector3;
+
+  explicit UniformBSpline3DEvaluator(const _Scalar &dt) : dt_(dt),
+      splines_{UniformBSpline<_N, _Scalar>(dt),
+               UniformBSpline<_N, _Scalar>(dt),
+               UniformBSpline<_N, _Scalar>(dt)}, yaw_spline_(dt) {
+  }
+
+  // Number of control points a window needs for a single valid segment
+  static int minWindowSize() {
+    return 2 * OFFSET + 2;
+  }
+
+  inline void push_back(const Vector3 & vec) {
+    for (int i = 0; i < 3; ++i) {
+      splines_[i].push_back(vec[i]);
+    }
+  }
+
+  // One yaw control point per position control point
+  inline void pushYaw(const _Scalar & yaw) {
+    yaw_spline_.push_back(yaw);
+  }
+
+  inline bool hasYaw() const {
+    return yaw_spline_.size() > 0 && yaw_spline_.size() == splines_[0].size();
+  }
+
+  inline int size() const {
+    return splines_[0].size();
+  }
+
+  inline _Scalar dt() const {
+    return dt_;
+  }
+
+  inline _Scalar duration() const {
+    return std::max(splines_[0].maxValidTime() - splines_[0].minValidTime(), _Scalar(0));
+  }
+
+  Vector3 evaluate(_Scalar t, int derivative) const {
+    _Scalar spline_time = splines_[0].minValidTime() + std::min(std::max(t, _Scalar(0)), duration());
+    return Vector3(splines_[0].evaluate(spline_time, derivative),
+                   splines_[1].evaluate(spline_time, derivative),
+                   splines_[2].evaluate(spline_time, derivative));
+  }
+
+  _Scalar evaluateYaw(_Scalar t, int derivative) const {
+    _Scalar spline_time = yaw_spline_.minValidTime() + std::min(std::max(t, _Scalar(0)), duration());
+    return yaw_spline_.evaluate(spline_time, derivative);
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+ protected:
+  _Scalar dt_;
+  UniformBSpline<_N, _Scalar> splines_[3];
+  UniformBSpline<_N, _Scalar> yaw_spline_;
+};
+
+}  // namespace ewok
+
+#endif  // EWOK_POLY_SPLINE_INCLUDE_EWOK_UNIFORM_BSPLINE_3D_EVALUATOR_H_
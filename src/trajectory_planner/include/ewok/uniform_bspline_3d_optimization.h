@@ -24,34 +24,53 @@
 #ifndef EWOK_OPTIMIZATION_INCLUDE_EWOK_UNIFORM_BSPLINE_3D_OPTIMIZATION_H_
 #define EWOK_OPTIMIZATION_INCLUDE_EWOK_UNIFORM_BSPLINE_3D_OPTIMIZATION_H_
 
+#include <ewok/uniform_bspline.h>
 #include <ewok/uniform_bspline_3d.h>
 #include <ewok/polynomial_trajectory_3d.h>
 #include <ewok/ed_ring_buffer.h>
 
 #include <visualization_msgs/MarkerArray.h>
 
+#include <Eigen/Geometry>
+#include <Eigen/Cholesky>
+
+#include <map>
+
 #include <nlopt.hpp>
 
 namespace ewok {
 
-template<int _N, typename _Scalar = double>
+// _DistanceProvider is queried for the distance to the closest obstacle. It has to provide
+//   _Scalar getDistanceWithGrad(const Vector3 & point, Vector3 & grad)
+//   void getDistancesWithGrad(const Vector3Array & points, std::vector<_Scalar> & distances, Vector3Array & grads)
+//   uint64_t getVersion() const
+// where the batched version returns the same as the single query for every point and the
+// version changes whenever the distances may have changed.
+template<int _N, typename _Scalar = double, typename _DistanceProvider = EuclideanDistanceRingBuffer<6>>
 class UniformBSpline3DOptimization {
  public:
 
   typedef Eigen::Matrix<_Scalar, 3, 1> Vector3;
   typedef Eigen::Matrix<_Scalar, 4, 1> Vector4;
+  typedef Eigen::Matrix<_Scalar, 3, 3> Matrix3;
 
   typedef Eigen::Matrix<_Scalar, 1, _N> VectorNT;
   typedef Eigen::Matrix<_Scalar, _N, 1> VectorN;
   typedef Eigen::Matrix <_Scalar, _N, _N> MatrixN;
 
-  typedef std::shared_ptr<UniformBSpline3DOptimization<_N, _Scalar>> Ptr;
+  typedef std::vector<Vector3, Eigen::aligned_allocator<Vector3>> Vector3Array;
+
+  // Control points a segment (with the one before, see collisionError) depends on
+  typedef Eigen::Matrix<_Scalar, 3, _N + 1> SegmentControlPoints;
+
+  typedef std::shared_ptr<UniformBSpline3DOptimization<_N, _Scalar, _DistanceProvider>> Ptr;
 
   UniformBSpline3DOptimization(const Vector3 &start_point, _Scalar dt) :
-      spline_(dt), num_cp_opt(-1), cp_opt_start_idx(_N) {
+      spline_(dt), yaw_spline_(dt), num_cp_opt(-1), cp_opt_start_idx(_N) {
     // Make sure initial position is static at starting point
     for (int i = 0; i < _N; i++) {
       spline_.push_back(start_point);
+      yaw_spline_.push_back(0);
     }
 
     _Scalar enpoint_time = spline_.maxValidTime() - eps;
@@ -66,13 +85,14 @@ class UniformBSpline3DOptimization {
 
 
   UniformBSpline3DOptimization(ewok::PolynomialTrajectory3D<10>::Ptr & trajectory, _Scalar dt) :
-      spline_(dt), num_cp_opt(-1), cp_opt_start_idx(_N), trajectory_(trajectory) {
+      spline_(dt), yaw_spline_(dt), num_cp_opt(-1), cp_opt_start_idx(_N), trajectory_(trajectory) {
 
     Vector3 start_point = trajectory_->evaluate(0,0);
 
     // Make sure initial position is static at starting point
     for (int i = 0; i < _N; i++) {
       spline_.push_back(start_point);
+      yaw_spline_.push_back(0);
     }
 
     _Scalar enpoint_time = spline_.maxValidTime() - eps;
@@ -87,6 +107,7 @@ class UniformBSpline3DOptimization {
 
   void setNumCollisionChecksPerSegment(int n) {
 
+    collision_cache_.clear();
 
     for(int k = 0; k < 5; k++) {
       segment_grads[k].resize(n);
@@ -119,13 +140,15 @@ class UniformBSpline3DOptimization {
     }
   }
 
-  void setDistanceBuffer(EuclideanDistanceRingBuffer<6>::Ptr & edrb) {
+  void setDistanceBuffer(const std::shared_ptr<_DistanceProvider> & edrb) {
     edrb_ = edrb;
+    collision_cache_.clear();
   }
 
   void addControlPoint(const Vector3 &point, int num = 1) {
     for (int i = 0; i < num; i++) {
       spline_.push_back(point);
+      yaw_spline_.push_back(yaw_spline_.coeff(yaw_spline_.size()-1));
     }
   }
 
@@ -135,6 +158,7 @@ class UniformBSpline3DOptimization {
 
   void addLastControlPoint() {
     spline_.push_back(spline_.getControlPoint(spline_.size()-1));
+    yaw_spline_.push_back(yaw_spline_.coeff(yaw_spline_.size()-1));
     cp_opt_start_idx++;
   }
 
@@ -142,6 +166,60 @@ class UniformBSpline3DOptimization {
     return spline_.getControlPoint(cp_opt_start_idx);
   }
 
+  inline _Scalar getFirstOptimizationYaw() {
+    return yaw_spline_.coeff(cp_opt_start_idx);
+  }
+
+  // Sets all yaw control points, e.g. to the current heading before the first optimization
+  void setInitialYaw(_Scalar yaw) {
+    for (int i = 0; i < yaw_spline_.size(); i++) {
+      yaw_spline_.coeff(i) = yaw;
+    }
+  }
+
+  // Control points from the segment starting at the first optimization point
+  // to the end of the spline, enough to evaluate the remaining trajectory.
+  void getControlPointsWindow(std::vector<Vector3, Eigen::aligned_allocator<Vector3>> & cps) {
+    cps.clear();
+    for (int i = std::max(cp_opt_start_idx - (_N/2 - 1), 0); i < spline_.size(); i++) {
+      cps.push_back(spline_.getControlPoint(i));
+    }
+  }
+
+  // Yaw control points of the same window as getControlPointsWindow
+  void getYawControlPointsWindow(std::vector<_Scalar> & yaws) {
+    yaws.clear();
+    for (int i = std::max(cp_opt_start_idx - (_N/2 - 1), 0); i < yaw_spline_.size(); i++) {
+      yaws.push_back(yaw_spline_.coeff(i));
+    }
+  }
+
+  // Time from the first optimization point until the remaining trajectory first
+  // gets closer than min_distance to an obstacle, or a negative value if it doesn't.
+  _Scalar checkTrajectory(_Scalar min_distance) const {
+    if(!edrb_.get()) return -1;
+
+    _Scalar t_start = cp_opt_start_idx * spline_.dt();
+    _Scalar t = spline_.checkTrajectory(*edrb_, min_distance, t_start, spline_.maxValidTime());
+
+    return t < 0 ? t : t - t_start;
+  }
+
+  // True if the last optimization brought the end of the spline to the target
+  // endpoint and the target has not moved since. Unless the map or the point of
+  // interest changed, optimizing again would then leave the window as it is.
+  bool isConverged(_Scalar tolerance) const {
+    Vector3 target = endpoints[0];
+
+    if(trajectory_.get()) {
+      _Scalar enpoint_time = spline_.maxValidTime() - spline_.minValidTime() - eps;
+      target = trajectory_->evaluate(enpoint_time, 0);
+    }
+
+    return (target - endpoints[0]).norm() < tolerance &&
+           (spline_.getControlPoint(spline_.size() - 1) - target).norm() < tolerance;
+  }
+
   void setNumControlPointsOptimized(int n) {
     num_cp_opt = n;
 
@@ -194,6 +272,114 @@ class UniformBSpline3DOptimization {
     cp_opt_start_idx = n;
   }
 
+  // Second stage after optimize(), with the position spline kept fixed. Fits the
+  // optimized yaw control points so that the camera looks at the point of
+  // interest, or, if there is none, keeps the target yaw (or follows the
+  // horizontal velocity if enabled), while keeping the yaw smooth. Samples
+  // without a direction (hovering, right below the point of interest) are
+  // skipped and a small regularization holds the previous yaw there.
+  // The cost is quadratic in the yaw control points, so a linear solve suffices.
+  void optimizeYaw() {
+    typedef Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic> MatrixX;
+    typedef Eigen::Matrix<_Scalar, Eigen::Dynamic, 1> VectorX;
+
+    int num_cp = yaw_spline_.size();
+    if (num_cp_opt <= 0 || cp_opt_start_idx + num_cp_opt > num_cp) return;
+
+    // Normal equations over all control points, the fixed ones are moved to
+    // the right hand side below
+    MatrixX H = MatrixX::Zero(num_cp, num_cp);
+    VectorX b = VectorX::Zero(num_cp);
+    VectorX y(num_cp);
+    for (int i = 0; i < num_cp; i++) y[i] = yaw_spline_.coeff(i);
+
+    int min_segment = std::max(yaw_spline_.minValidIdx(), cp_opt_start_idx + UniformBSpline<_N, _Scalar>::OFFSET - _N + 1);
+    int max_segment = std::min(yaw_spline_.maxValidIdx(), cp_opt_start_idx + num_cp_opt + UniformBSpline<_N, _Scalar>::OFFSET);
+
+    for (int segment = min_segment; segment < max_segment; segment++) {
+      for (int k = 0; k < yaw_samples_per_segment_; k++) {
+        _Scalar t = (segment + (k + _Scalar(0.5)) / yaw_samples_per_segment_) * spline_.dt();
+
+        _Scalar target_angle = target_yaw_;
+        if (point_of_interest_active_ || yaw_follows_velocity_) {
+          Vector3 direction;
+          if (point_of_interest_active_) {
+            direction = point_of_interest_ - spline_.evaluate(t, 0);
+          } else {
+            direction = spline_.evaluate(t, 1);
+          }
+          direction[2] = 0;
+
+          if (direction.norm() < yaw_min_speed_) continue;
+          target_angle = std::atan2(direction[1], direction[0]);
+        }
+
+        int grad_start_idx;
+        VectorNT g;
+        _Scalar yaw = yaw_spline_.evaluateWithControlPointsGrad(t, 0, grad_start_idx, g);
+
+        // Closest equivalent of the target angle to the current yaw
+        _Scalar target = yaw + std::remainder(target_angle - yaw, _Scalar(2 * M_PI));
+
+        for (int i = 0; i < _N; i++) {
+          b[grad_start_idx + i] += g[i] * target;
+          for (int j = 0; j < _N; j++) {
+            H(grad_start_idx + i, grad_start_idx + j) += g[i] * g[j];
+          }
+        }
+      }
+    }
+
+    // Differences of consecutive control points bound the yaw rate and
+    // acceleration of the spline and also suppress alternating control points,
+    // which the samples hardly see
+    for (int i = std::max(cp_opt_start_idx - 2, 0); i + 2 < num_cp; i++) {
+      Eigen::Matrix<_Scalar, 3, 1> d1(-1, 1, 0), d2(1, -2, 1);
+      H.block(i, i, 3, 3) += yaw_smoothness_weights[0] * d1 * d1.transpose()
+          + yaw_smoothness_weights[1] * d2 * d2.transpose();
+    }
+    H(num_cp - 2, num_cp - 2) += yaw_smoothness_weights[0];
+    H(num_cp - 1, num_cp - 1) += yaw_smoothness_weights[0];
+    H(num_cp - 2, num_cp - 1) -= yaw_smoothness_weights[0];
+    H(num_cp - 1, num_cp - 2) -= yaw_smoothness_weights[0];
+
+    MatrixX H_opt = H.block(cp_opt_start_idx, cp_opt_start_idx, num_cp_opt, num_cp_opt);
+    VectorX b_opt = b.segment(cp_opt_start_idx, num_cp_opt);
+
+    for (int i = 0; i < num_cp; i++) {
+      if (i < cp_opt_start_idx || i >= cp_opt_start_idx + num_cp_opt) {
+        b_opt -= H.block(cp_opt_start_idx, i, num_cp_opt, 1) * y[i];
+      }
+    }
+
+    H_opt.diagonal().array() += yaw_regularization_weight_;
+    b_opt += yaw_regularization_weight_ * y.segment(cp_opt_start_idx, num_cp_opt);
+
+    VectorX y_opt = H_opt.ldlt().solve(b_opt);
+
+    for (int i = 0; i < num_cp_opt; i++) {
+      yaw_spline_.coeff(cp_opt_start_idx + i) = y_opt[i];
+    }
+  }
+
+  // Yaw kept by optimizeYaw() without a point of interest, e.g. the orientation
+  // requested for the endpoint
+  void setTargetYaw(_Scalar yaw) {
+    target_yaw_ = yaw;
+  }
+
+  // Without a point of interest, turn the camera along the horizontal velocity
+  // instead of keeping the target yaw
+  void setYawFollowsVelocity(bool follow) {
+    yaw_follows_velocity_ = follow;
+  }
+
+  // Weights of the squared first and second differences of the yaw control points
+  void setYawSmoothnessWeights(_Scalar first_difference_weight, _Scalar second_difference_weight) {
+    yaw_smoothness_weights[0] = first_difference_weight;
+    yaw_smoothness_weights[1] = second_difference_weight;
+  }
+
   void getMarkers(visualization_msgs::MarkerArray & traj_marker,
                   const std::string & ns = "spline_opitimization_markers",
                   const Vector3 & color1 = Vector3(0,1,0),
@@ -223,27 +409,9 @@ class UniformBSpline3DOptimization {
 
   // Method inteded for testing only!!!
   double getNumericEndpointErrorGrad(std::vector<double> &grad, int deriv) const {
-
-    double delta = 0.0001;
-
-    grad.resize(3*num_cp_opt);
-    std::fill(grad.begin(), grad.end(), 0.0);
-
-    std::vector<double> tmp;
-
-    double value = endpointError(spline_, deriv, 1.0, tmp);
-
-    for(int i=0; i<3; i++) {
-      for(int j=0; j<num_cp_opt; j++) {
-        UniformBSpline3D <_N, _Scalar> current_spline = spline_;
-
-        current_spline.coeff(i, cp_opt_start_idx + j) += delta;
-        grad[i*num_cp_opt + j] = (endpointError(current_spline, deriv, 1.0, tmp) - value)/delta;
-      }
-    }
-
-    return value;
-
+    return getNumericErrorGrad(grad, 0.0001,
+        [&](const UniformBSpline3D <_N, _Scalar> & current_spline, std::vector<double> & tmp)
+        { return endpointError(current_spline, deriv, 1.0, tmp); });
   }
 
   // Method inteded for testing only!!!
@@ -256,25 +424,9 @@ class UniformBSpline3DOptimization {
 
   // Method inteded for testing only!!!
   double getNumericQuadraticErrorGrad(std::vector<double> &grad) const {
-
-    double delta = 0.0001;
-
-    grad.resize(3*num_cp_opt);
-    std::fill(grad.begin(), grad.end(), 0.0);
-
-    std::vector<double> tmp;
-
-    double value = quadraticCostError(spline_, 1.0, tmp);
-
-    for(int i=0; i<3; i++) {
-      for(int j=0; j<num_cp_opt; j++) {
-        UniformBSpline3D <_N, _Scalar> current_spline = spline_;
-
-        current_spline.coeff(i, cp_opt_start_idx + j) += delta;
-        grad[i*num_cp_opt + j] = (quadraticCostError(current_spline, 1.0, tmp) - value)/delta;
-      }
-    }
-    return value;
+    return getNumericErrorGrad(grad, 0.0001,
+        [&](const UniformBSpline3D <_N, _Scalar> & current_spline, std::vector<double> & tmp)
+        { return quadraticCostError(current_spline, 1.0, tmp); });
   }
 
 
@@ -288,64 +440,108 @@ class UniformBSpline3DOptimization {
 
   // Method inteded for testing only!!!
   double getNumericCollisionErrorGrad(std::vector<double> &grad) const {
+    return getNumericErrorGrad(grad, 0.0001,
+        [&](const UniformBSpline3D <_N, _Scalar> & current_spline, std::vector<double> & tmp)
+        { return collisionError(current_spline, 1.0, tmp); });
+  }
 
-    double delta = 0.0001;
-
+  // Method inteded for testing only!!!
+  double getAnalyticSoftLimitErrorGrad(std::vector<double> &grad, int deriv) const {
     grad.resize(3*num_cp_opt);
     std::fill(grad.begin(), grad.end(), 0.0);
 
-    std::vector<double> tmp;
-
-    double value = collisionError(spline_, 1.0, tmp);
-    for(int i=0; i<3; i++) {
-      for (int j = 0; j < num_cp_opt; j++) {
-        UniformBSpline3D <_N, _Scalar> current_spline = spline_;
-
-        current_spline.coeff(i, cp_opt_start_idx + j) += delta;
-        grad[i * num_cp_opt + j] =
-            (collisionError(current_spline, 1.0, tmp) - value) / delta;
-      }
-    }
-
-    return value;
+    return softLimitError(spline_, deriv, 1.0, grad);
+  }
 
+  // Method inteded for testing only!!!
+  double getNumericSoftLimitErrorGrad(std::vector<double> &grad, int deriv) const {
+    return getNumericErrorGrad(grad, 1e-8,
+        [&](const UniformBSpline3D <_N, _Scalar> & current_spline, std::vector<double> & tmp)
+        { return softLimitError(current_spline, deriv, 1.0, tmp); });
   }
 
   // Method inteded for testing only!!!
-  double getAnalyticSoftLimitErrorGrad(std::vector<double> &grad, int deriv) const {
+  double getAnalyticVisibilityErrorGrad(std::vector<double> &grad) const {
     grad.resize(3*num_cp_opt);
     std::fill(grad.begin(), grad.end(), 0.0);
 
-    return softLimitError(spline_, deriv, 1.0, grad);
+    return visibilityError(spline_, 1.0, grad);
   }
 
   // Method inteded for testing only!!!
-  double getNumericSoftLimitErrorGrad(std::vector<double> &grad, int deriv) const {
+  double getNumericVisibilityErrorGrad(std::vector<double> &grad) const {
+    return getNumericErrorGrad(grad, 0.0001,
+        [&](const UniformBSpline3D <_N, _Scalar> & current_spline, std::vector<double> & tmp)
+        { return visibilityError(current_spline, 1.0, tmp); });
+  }
 
-    double delta = 1e-8;
+  // Central differences of an error term w.r.t. the optimized control points, perturbing
+  // a single copy of the spline in place
+  template<typename F>
+  double getNumericErrorGrad(std::vector<double> &grad, double delta, F error) const {
 
     grad.resize(3*num_cp_opt);
     std::fill(grad.begin(), grad.end(), 0.0);
 
     std::vector<double> tmp;
 
-    double value = softLimitError(spline_, deriv, 1.0, tmp);
+    UniformBSpline3D <_N, _Scalar> current_spline = spline_;
+    double value = error(current_spline, tmp);
 
     for(int i=0; i<3; i++) {
       for(int j=0; j<num_cp_opt; j++) {
-        UniformBSpline3D <_N, _Scalar> current_spline = spline_;
+        _Scalar & coeff = current_spline.coeff(i, cp_opt_start_idx + j);
+        _Scalar original = coeff;
 
-        current_spline.coeff(i, cp_opt_start_idx + j) += delta;
-        grad[i*num_cp_opt + j] = (softLimitError(current_spline, deriv, 1.0, tmp) - value)/delta;
+        coeff = original + delta;
+        double value_plus = error(current_spline, tmp);
+        coeff = original - delta;
+        double value_minus = error(current_spline, tmp);
+        coeff = original;
+
+        grad[i*num_cp_opt + j] = (value_plus - value_minus)/(2*delta);
       }
     }
 
     return value;
-
   }
 
   void setDistanceThreshold(_Scalar d){
     distance_threshold_ = d;
+    collision_cache_.clear();
+  }
+
+  // Pinhole model of the camera that should keep the point of interest in view.
+  // The image rectangle is shrunk by margin pixels on every side, rotation and
+  // offset are the pose of the (optical) camera frame in the body frame.
+  void setVisibilityCamera(_Scalar fx, _Scalar fy, _Scalar cx, _Scalar cy,
+                           int width, int height, _Scalar margin,
+                           const Matrix3 & R_b_c, const Vector3 & t_b_c) {
+    image_min_ = Vector3((margin - cx)/fx, (margin - cy)/fy, 0);
+    image_max_ = Vector3((width - margin - cx)/fx, (height - margin - cy)/fy, 0);
+    R_b_c_ = R_b_c;
+    t_b_c_ = t_b_c;
+
+    if(point_of_interest_active_) setPointOfInterest(point_of_interest_, point_of_interest_yaw_);
+  }
+
+  // The spline has no orientation, the camera is assumed to keep the given yaw
+  // (the one the controller flies the trajectory with) over the whole horizon.
+  void setPointOfInterest(const Vector3 & point, _Scalar yaw) {
+    Matrix3 R_w_b = Eigen::AngleAxis<_Scalar>(yaw, Vector3::UnitZ()).toRotationMatrix();
+    R_c_w_ = (R_w_b * R_b_c_).transpose();
+    t_w_c_ = R_w_b * t_b_c_;
+    point_of_interest_ = point;
+    point_of_interest_yaw_ = yaw;
+    point_of_interest_active_ = true;
+  }
+
+  void clearPointOfInterest() {
+    point_of_interest_active_ = false;
+  }
+
+  void setVisibilityWeight(_Scalar w) {
+    visibility_weight = w;
   }
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
@@ -377,6 +573,7 @@ class UniformBSpline3DOptimization {
 
   void setDefaultWeights() {
     collision_weight = 1e5;
+    visibility_weight = 1e3;
     endpoint_error_weights = Vector3(100, 10, 0);
 
     setQuadraticErrorWeights(Vector3(0.1, 0.1, 0.1));
@@ -387,6 +584,22 @@ class UniformBSpline3DOptimization {
     setLimits(Vector4(2,5,0,0));
     limits_weight_ = 1.0;
 
+    // Forward looking camera in the body origin with a 90 deg horizontal field of view
+    point_of_interest_active_ = false;
+    visibility_min_depth_ = 0.3;
+
+    Matrix3 R_b_c;
+    R_b_c << 0, 0, 1,
+            -1, 0, 0,
+             0,-1, 0;
+    setVisibilityCamera(320, 320, 320, 240, 640, 480, 40, R_b_c, Vector3::Zero());
+
+    setYawSmoothnessWeights(1, 1);
+    yaw_regularization_weight_ = 1e-3;
+    target_yaw_ = 0;
+    yaw_follows_velocity_ = false;
+    yaw_min_speed_ = 0.1;
+    yaw_samples_per_segment_ = 4;
 
   }
 
@@ -424,6 +637,8 @@ class UniformBSpline3DOptimization {
 
     value += collisionError(current_spline, collision_weight, grad);
 
+    value += visibilityError(current_spline, visibility_weight, grad);
+
     for(int i=1; i<5; i++) {
       value += softLimitError(current_spline, i, limits_weight_, grad);
     }
@@ -486,6 +701,9 @@ class UniformBSpline3DOptimization {
 
   }
 
+  // The collision cost and gradient of every segment are cached and only recomputed when
+  // one of its control points moved or the distance map changed, as NLopt often leaves
+  // most control points untouched between evaluations.
   double collisionError(const UniformBSpline3D <_N, _Scalar> & current_spline,
                         double lambda, std::vector<double> &grad) const {
 
@@ -496,26 +714,161 @@ class UniformBSpline3DOptimization {
     int start_segment_idx = cp_opt_start_idx - (_N/2 - 1);
     int end_segment_idx = std::min(cp_opt_start_idx + num_cp_opt + _N/2, spline_.maxValidIdx());
 
+    int num_checks = segment_grads[0].size();
+    uint64_t map_version = edrb_->getVersion();
+
+    // Segments before the optimization window are never evaluated again
+    collision_cache_.erase(collision_cache_.begin(), collision_cache_.lower_bound(start_segment_idx));
+
+    // Sample the points of all outdated segments and query the distances in one batch
+    collision_points_.clear();
+    collision_segment_starts_.clear();
+    collision_outdated_segments_.clear();
+
+    for(int segment_idx = start_segment_idx; segment_idx < end_segment_idx; segment_idx++) {
+      SegmentControlPoints control_points;
+      getSegmentControlPoints(current_spline, segment_idx, control_points);
+
+      CollisionCacheEntry & entry = collision_cache_[segment_idx];
+      if(entry.valid && entry.map_version == map_version && entry.control_points == control_points) continue;
+
+      entry.valid = true;
+      entry.map_version = map_version;
+      entry.control_points = control_points;
+      entry.error = 0;
+      entry.grad.setZero();
+      collision_outdated_segments_.push_back(segment_idx);
+
+      for(int k=0; k<num_checks; k++) {
+        _Scalar current_time = (segment_idx + k/ static_cast<double>(num_checks)) * spline_.dt();
+
+        int s_i;
+        collision_points_.push_back(current_spline.evaluate(current_time, 0, s_i));
+        collision_segment_starts_.push_back(s_i);
+      }
+    }
+
+    if(!collision_points_.empty()) {
+      edrb_->getDistancesWithGrad(collision_points_, collision_distances_, collision_grads_);
+    }
+
+    int num_points = collision_points_.size();
+    for(int j = 0; j < num_points; j++) {
+      int segment_idx = collision_outdated_segments_[j / num_checks];
+      int k = j % num_checks;
+      int s_i = collision_segment_starts_[j];
+      _Scalar dist = collision_distances_[j];
+      const Vector3 & grad_p = collision_grads_[j];
+
+      if(dist > distance_threshold_) continue;
+
+      CollisionCacheEntry & entry = collision_cache_[segment_idx];
+
+      _Scalar diff = dist - distance_threshold_;
+      _Scalar error = 0.5 * diff * diff / distance_threshold_;
+      entry.error += error;
+
+      //ROS_INFO_STREAM("dist: " << dist << " error: " << error);
+
+      // Column 0 of the entry is the control point before the segment
+      int grad_start_col = s_i - segment_idx + 1;
+
+      for (int i = 0; i < _N; i++) {
+        entry.grad.col(grad_start_col + i) += (diff/distance_threshold_) * grad_p * segment_grads[0][k][i];
+      }
+    }
+
+    for(int segment_idx = start_segment_idx; segment_idx < end_segment_idx; segment_idx++) {
+      const CollisionCacheEntry & entry = collision_cache_[segment_idx];
+      total_error += entry.error;
+
+      if (!grad.empty() && entry.error > 0) {
+
+        int grad_start_idx = segment_idx - (_N / 2 - 1) - 1;
+
+        for (int i = 0; i < _N + 1; i++) {
+          int current_idx = grad_start_idx + i;
+          if (current_idx >= cp_opt_start_idx
+              && current_idx < (cp_opt_start_idx + num_cp_opt)) {
+
+            int idx = current_idx - cp_opt_start_idx;
+
+            grad[0 * num_cp_opt + idx] += lambda * entry.grad(0, i);
+            grad[1 * num_cp_opt + idx] += lambda * entry.grad(1, i);
+            grad[2 * num_cp_opt + idx] += lambda * entry.grad(2, i);
+          }
+        }
+      }
+    }
+
+    //if(total_error > 0) ROS_INFO_STREAM("Total collision error: " << lambda * total_error);
+    return lambda * total_error;
+
+  }
+
+  // Samples of a segment may fall into the previous one because of rounding, so the
+  // control point before the segment is included as well
+  void getSegmentControlPoints(const UniformBSpline3D <_N, _Scalar> & current_spline, int segment_idx,
+                               SegmentControlPoints & control_points) const {
+    int start_idx = segment_idx - (_N / 2 - 1) - 1;
+    for (int i = 0; i < _N + 1; i++) {
+      int idx = std::min(std::max(start_idx + i, 0), current_spline.size() - 1);
+      for (int d = 0; d < 3; d++) {
+        control_points(d, i) = current_spline.coeff(d, idx);
+      }
+    }
+  }
+
+  // Penalizes sampled positions from which the point of interest projects outside
+  // of the shrunken image rectangle (in normalized image coordinates) or lies
+  // closer than visibility_min_depth_ in front of the camera.
+  double visibilityError(const UniformBSpline3D <_N, _Scalar> & current_spline,
+                         double lambda, std::vector<double> &grad) const {
+
+    if(!point_of_interest_active_) return 0;
+
+    double total_error = 0;
+
+    int start_segment_idx = cp_opt_start_idx - (_N/2 - 1);
+    int end_segment_idx = std::min(cp_opt_start_idx + num_cp_opt + _N/2, spline_.maxValidIdx());
+
     for(int segment_idx = start_segment_idx; segment_idx < end_segment_idx; segment_idx++) {
-      for(int k=0; k<segment_grads[0].size(); k++) {
+      for(size_t k=0; k<segment_grads[0].size(); k++) {
         _Scalar current_time = (segment_idx + k/ static_cast<double>(segment_grads[0].size())) * spline_.dt();
 
         int s_i;
-        Vector3 point, grad_p;
+        Vector3 point, q, grad_q(0, 0, 0);
         point = current_spline.evaluate(current_time, 0, s_i);
 
-        _Scalar dist = edrb_->getDistanceWithGrad(point, grad_p);
+        // Point of interest in the camera frame
+        q = R_c_w_ * (point_of_interest_ - point - t_w_c_);
 
-        if(dist > distance_threshold_) continue;
+        _Scalar error = 0;
 
-        _Scalar diff = dist - distance_threshold_;
-        _Scalar error = 0.5 * diff * diff / distance_threshold_;
-        total_error += error;
+        if(q[2] < visibility_min_depth_) {
+          _Scalar diff = q[2] - visibility_min_depth_;
+          error = diff * diff;
+          grad_q[2] = 2 * diff;
+        } else {
+          _Scalar x = q[0] / q[2], y = q[1] / q[2];
+          _Scalar diff_x = x < image_min_[0] ? x - image_min_[0] : (x > image_max_[0] ? x - image_max_[0] : 0);
+          _Scalar diff_y = y < image_min_[1] ? y - image_min_[1] : (y > image_max_[1] ? y - image_max_[1] : 0);
+
+          if(diff_x == 0 && diff_y == 0) continue;
+
+          error = diff_x * diff_x + diff_y * diff_y;
+          grad_q[0] = 2 * diff_x / q[2];
+          grad_q[1] = 2 * diff_y / q[2];
+          grad_q[2] = -2 * (diff_x * x + diff_y * y) / q[2];
+        }
 
-        //ROS_INFO_STREAM("dist: " << dist << " error: " << error);
+        total_error += error;
 
         if (!grad.empty()) {
 
+          // q depends on the position through -R_c_w_
+          Vector3 grad_p = -R_c_w_.transpose() * grad_q;
+
           int grad_start_idx = s_i - (_N / 2 - 1);
 
           for (int i = 0; i < _N; i++) {
@@ -525,19 +878,15 @@ class UniformBSpline3DOptimization {
 
               int idx = current_idx - cp_opt_start_idx;
 
-              grad[0 * num_cp_opt + idx] +=
-                  lambda * (diff/distance_threshold_) * grad_p[0] * segment_grads[0][k][i];
-              grad[1 * num_cp_opt + idx] +=
-                  lambda * (diff/distance_threshold_) * grad_p[1] * segment_grads[0][k][i];
-              grad[2 * num_cp_opt + idx] +=
-                  lambda * (diff/distance_threshold_) * grad_p[2] * segment_grads[0][k][i];
+              grad[0 * num_cp_opt + idx] += lambda * grad_p[0] * segment_grads[0][k][i];
+              grad[1 * num_cp_opt + idx] += lambda * grad_p[1] * segment_grads[0][k][i];
+              grad[2 * num_cp_opt + idx] += lambda * grad_p[2] * segment_grads[0][k][i];
             }
           }
         }
       }
     }
 
-    //if(total_error > 0) ROS_INFO_STREAM("Total collision error: " << lambda * total_error);
     return lambda * total_error;
 
   }
@@ -617,17 +966,55 @@ class UniformBSpline3DOptimization {
 
   Vector3 endpoint_error_weights;
   _Scalar collision_weight;
+  _Scalar visibility_weight;
+
+  bool point_of_interest_active_;
+  Vector3 point_of_interest_;
+  _Scalar point_of_interest_yaw_;
+  Matrix3 R_b_c_, R_c_w_;
+  Vector3 t_b_c_, t_w_c_;
+  Vector3 image_min_, image_max_;
+  _Scalar visibility_min_depth_;
 
   typename UniformBSpline3D <_N, _Scalar>::MatrixN quadratic_cost_matrix;
 
   UniformBSpline3D <_N, _Scalar> spline_;
 
+  // One yaw control point per control point of spline_
+  UniformBSpline <_N, _Scalar> yaw_spline_;
+  _Scalar yaw_smoothness_weights[2];
+  _Scalar yaw_regularization_weight_;
+  _Scalar target_yaw_;
+  bool yaw_follows_velocity_;
+  _Scalar yaw_min_speed_; // also the minimum horizontal distance to the point of interest
+  int yaw_samples_per_segment_;
+
   int num_cp_opt;
   int cp_opt_start_idx;
 
   std::shared_ptr<nlopt::opt> optimizer, trajectory_time_optimizer;
 
-  EuclideanDistanceRingBuffer<6>::Ptr edrb_;
+  std::shared_ptr<_DistanceProvider> edrb_;
+
+  struct CollisionCacheEntry {
+    CollisionCacheEntry() : valid(false) {}
+
+    bool valid;
+    uint64_t map_version;
+    SegmentControlPoints control_points;
+    _Scalar error;
+    SegmentControlPoints grad; // of the error w.r.t. control_points
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  mutable std::map<int, CollisionCacheEntry, std::less<int>,
+      Eigen::aligned_allocator<std::pair<const int, CollisionCacheEntry>>> collision_cache_;
+
+  // Scratch space of collisionError, reused between calls
+  mutable Vector3Array collision_points_, collision_grads_;
+  mutable std::vector<_Scalar> collision_distances_;
+  mutable std::vector<int> collision_segment_starts_, collision_outdated_segments_;
 
   ewok::PolynomialTrajectory3D<10>::Ptr trajectory_;
 
@@ -0,0 +1,291 @@
+/**
+* This file is part of Ewok.
+*
+* Copyright 2017 Vladyslav Usenko, Technical University of Munich.
+* Developed by Vladyslav Usenko <vlad dot usenko at tum dot de>,
+* for more information see <http://vision.in.tum.de/research/robotvision/replanning>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* Ewok is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* Ewok is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with Ewok. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORY_PLANNER_DEPTH_SENSOR_FRONTEND_H_
+#define TRAJECTORY_PLANNER_DEPTH_SENSOR_FRONTEND_H_
+
+#include <ros/ros.h>
+#include <Eigen/Geometry>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <tf/transform_listener.h>
+#include <tf_conversions/tf_eigen.h>
+#include <boost/bind.hpp>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// Converts the depth images and point clouds of any number of sensors into
+// world frame point clouds and inserts them into one distance buffer.
+//
+// Sensors are listed in the private parameter "sensors" (default: "camera"),
+// every sensor reads its settings from the private namespace of its name:
+//   depth_topic        depth image, 16UC1 in mm or 32FC1 in m (default: /<name>/depth/image_raw)
+//   camera_info_topic  intrinsics of the depth image (default: /<name>/depth/camera_info)
+//   cloud_topic        point cloud, used instead of the depth image if set
+//   frame              sensor frame, the frame of the message if empty (default: <name>)
+//   subsample          only every n-th row and column of the depth image is used (default: 4)
+//   max_range          points further away only clear free space up to this range, 0 disables (default: 0)
+//   clear_no_return    depth pixels without a return clear free space up to max_range (default: false),
+//                      only for sensors that do not report too close surfaces as no return
+//   fx, fy, cx, cy     intrinsics used until the first camera info is received
+//
+// Clouds are only queued in the callbacks and inserted in one batch by flush(),
+// which the caller runs once per mapping tick before updating the distances.
+template<class _DistanceBuffer>
+class DepthSensorFrontend {
+ public:
+
+  typedef typename _DistanceBuffer::PointCloud PointCloud;
+
+  DepthSensorFrontend(ros::NodeHandle & nh, ros::NodeHandle & pnh,
+                      tf::TransformListener & listener, const std::string & world_frame = "world") :
+      listener_(listener), world_frame_(world_frame), initialized_(false) {
+
+    std::vector<std::string> names;
+    if(!pnh.getParam("sensors", names)) names.push_back("camera");
+
+    sensors_.resize(names.size());
+
+    for(size_t i = 0; i < names.size(); i++)
+    {
+      Sensor & s = sensors_[i];
+      ros::NodeHandle snh(pnh, names[i]);
+
+      std::string depth_topic, camera_info_topic, cloud_topic;
+      snh.param("depth_topic", depth_topic, "/" + names[i] + "/depth/image_raw");
+      snh.param("camera_info_topic", camera_info_topic, "/" + names[i] + "/depth/camera_info");
+      snh.param("cloud_topic", cloud_topic, std::string());
+      snh.param("frame", s.frame, names[i]);
+      snh.param("subsample", s.subsample, 4);
+      snh.param("max_range", s.max_range, 0.0);
+      snh.param("clear_no_return", s.clear_no_return, false);
+      snh.param("fx", s.fx, 457.815979003906);
+      snh.param("fy", s.fy, 457.815979003906);
+      snh.param("cx", s.cx, 249.322647094727);
+      snh.param("cy", s.cy, 179.5);
+
+      s.name = names[i];
+      s.subsample = std::max(1, s.subsample);
+
+      if(!cloud_topic.empty())
+      {
+        s.data_sub = nh.subscribe<sensor_msgs::PointCloud2>(cloud_topic, 1,
+            boost::bind(&DepthSensorFrontend::cloudCallback, this, _1, i));
+        ROS_INFO_STREAM("Sensor " << s.name << ": point cloud " << cloud_topic);
+      }
+      else
+      {
+        s.data_sub = nh.subscribe<sensor_msgs::Image>(depth_topic, 1,
+            boost::bind(&DepthSensorFrontend::depthCallback, this, _1, i));
+        s.info_sub = nh.subscribe<sensor_msgs::CameraInfo>(camera_info_topic, 1,
+            boost::bind(&DepthSensorFrontend::cameraInfoCallback, this, _1, i));
+        ROS_INFO_STREAM("Sensor " << s.name << ": depth image " << depth_topic);
+      }
+    }
+  }
+
+  // Inserts all queued clouds in the order they were received, moving the
+  // volume along with the sensor origins. Returns the number of inserted clouds.
+  int flush(_DistanceBuffer & edrb) {
+
+    int num_inserted = pending_.size();
+
+    for(const Insertion & insertion : pending_)
+    {
+      Eigen::Vector3i origin_idx;
+      edrb.getIdx(insertion.origin, origin_idx);
+
+      if(!initialized_)
+      {
+        ROS_INFO_STREAM("Origin: " << insertion.origin.transpose() << " idx " << origin_idx.transpose());
+
+        edrb.setOffset(origin_idx);
+        initialized_ = true;
+      }
+      else
+      {
+        Eigen::Vector3i diff = origin_idx - edrb.getVolumeCenter();
+
+        while(diff.array().any())
+        {
+          edrb.moveVolume(diff);
+          diff = origin_idx - edrb.getVolumeCenter();
+        }
+      }
+
+      edrb.updateDecay(insertion.stamp);
+      edrb.insertPointCloud(insertion.cloud, insertion.origin, insertion.max_range);
+    }
+
+    pending_.clear();
+
+    return num_inserted;
+  }
+
+  // Drops all queued clouds
+  void clear() {
+    pending_.clear();
+  }
+
+ private:
+
+  struct Sensor {
+    std::string name, frame;
+    int subsample;
+    double max_range;
+    bool clear_no_return;
+    double fx, fy, cx, cy;
+    ros::Subscriber data_sub, info_sub;
+  };
+
+  struct Insertion {
+    PointCloud cloud;
+    Eigen::Vector3f origin;
+    float max_range;
+    double stamp;
+  };
+
+  bool lookupTransform(const Sensor & s, const std_msgs::Header & header, Eigen::Affine3f & T_w_s) {
+    const std::string & frame = s.frame.empty() ? header.frame_id : s.frame;
+
+    tf::StampedTransform transform;
+
+    try
+    {
+      listener_.lookupTransform(world_frame_, frame, ros::Time(0), transform);
+    }
+    catch (tf::TransformException &ex)
+    {
+      ROS_WARN_STREAM_THROTTLE(1, "Couldn't get transform of sensor " << s.name << ": " << ex.what());
+      return false;
+    }
+
+    Eigen::Affine3d dT_w_s;
+    tf::transformTFToEigen(transform, dT_w_s);
+    T_w_s = dT_w_s.cast<float>();
+
+    return true;
+  }
+
+  void cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr & msg, size_t i) {
+    Sensor & s = sensors_[i];
+
+    s.fx = msg->K[0];
+    s.fy = msg->K[4];
+    s.cx = msg->K[2];
+    s.cy = msg->K[5];
+  }
+
+  void depthCallback(const sensor_msgs::Image::ConstPtr & msg, size_t i) {
+    const Sensor & s = sensors_[i];
+
+    bool encoding_float = (msg->encoding == "32FC1");
+    if(!encoding_float && msg->encoding != "16UC1")
+    {
+      ROS_WARN_STREAM_THROTTLE(1, "Unsupported depth image encoding " << msg->encoding << " of sensor " << s.name);
+      return;
+    }
+
+    Eigen::Affine3f T_w_s;
+    if(!lookupTransform(s, msg->header, T_w_s)) return;
+
+    Insertion insertion;
+    insertion.origin = T_w_s.translation();
+    insertion.max_range = s.max_range;
+    insertion.stamp = msg->header.stamp.toSec();
+
+    // Beyond the maximum range along every pixel ray, truncated during insertion
+    bool clear_no_return = s.clear_no_return && s.max_range > 0;
+    float no_return_depth = 2 * s.max_range;
+
+    for(int v = 0; v < msg->height; v += s.subsample)
+    {
+      const uint8_t * row = &msg->data[v*msg->step];
+
+      for(int u = 0; u < msg->width; u += s.subsample)
+      {
+        float val;
+        if(encoding_float)
+        {
+          val = *(const float *)&row[u*4];
+        }
+        else
+        {
+          val = *(const uint16_t *)&row[u*2] / 1000.0; //Depth data is represented in mm
+        }
+
+        if(clear_no_return && (val == 0 || !std::isfinite(val)))
+        {
+          val = no_return_depth;
+        }
+
+        if(std::isfinite(val) && val > 0.05)
+        {
+          Eigen::Vector4f p(val*(u - s.cx)/s.fx, val*(v - s.cy)/s.fy, val, 1);
+          insertion.cloud.push_back(T_w_s * p);
+        }
+      }
+    }
+
+    pending_.push_back(insertion);
+  }
+
+  void cloudCallback(const sensor_msgs::PointCloud2::ConstPtr & msg, size_t i) {
+    const Sensor & s = sensors_[i];
+
+    Eigen::Affine3f T_w_s;
+    if(!lookupTransform(s, msg->header, T_w_s)) return;
+
+    Insertion insertion;
+    insertion.origin = T_w_s.translation();
+    insertion.max_range = s.max_range;
+    insertion.stamp = msg->header.stamp.toSec();
+    insertion.cloud.reserve(msg->width * msg->height);
+
+    sensor_msgs::PointCloud2ConstIterator<float> x(*msg, "x"), y(*msg, "y"), z(*msg, "z");
+
+    for(; x != x.end(); ++x, ++y, ++z)
+    {
+      if(std::isfinite(*x) && std::isfinite(*y) && std::isfinite(*z))
+      {
+        insertion.cloud.push_back(T_w_s * Eigen::Vector4f(*x, *y, *z, 1));
+      }
+    }
+
+    pending_.push_back(insertion);
+  }
+
+  tf::TransformListener & listener_;
+  std::string world_frame_;
+
+  std::vector<Sensor> sensors_;
+  std::deque<Insertion> pending_;
+
+  bool initialized_;
+};
+
+#endif // TRAJECTORY_PLANNER_DEPTH_SENSOR_FRONTEND_H_
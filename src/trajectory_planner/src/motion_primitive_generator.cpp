@@ -0,0 +1,74 @@
+/**
+* This file is part of Ewok.
+*
+* Copyright 2017 Vladyslav Usenko, Technical University of Munich.
+* Developed by Vladyslav Usenko <vlad dot usenko at tum dot de>,
+* for more information see <http://vision.in.tum.de/research/robotvision/replanning>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* Ewok is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* Ewok is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with Ewok. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Generates the motion primitive library used by trajectory_planner to seed the
+// spline optimization. dt and the number of control points have to match the
+// planner.
+//
+// usage: motion_primitive_generator <output file> [dt] [num control points]
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include <ewok/motion_primitive_library.h>
+
+// Relative to the goal direction, in degrees
+static const double max_heading = 90;
+static const double heading_step = 15;
+static const double climb_angles[] = {-20, 0, 20};
+
+// In m/s
+static const double speeds[] = {0.5, 1.0};
+
+int main(int argc, char **argv) {
+
+  if(argc < 2) {
+    std::cout << "usage: motion_primitive_generator <output file> [dt] [num control points]" << std::endl;
+    return 1;
+  }
+
+  double dt = argc > 2 ? std::atof(argv[2]) : 0.5;
+  int num_control_points = argc > 3 ? std::atoi(argv[3]) : 7;
+
+  std::vector<double> headings, climbs, speed_grid(std::begin(speeds), std::end(speeds));
+  for(double h = -max_heading; h <= max_heading + 1e-6; h += heading_step) {
+    headings.push_back(h * M_PI / 180);
+  }
+  for(double c : climb_angles) {
+    climbs.push_back(c * M_PI / 180);
+  }
+
+  ewok::MotionPrimitiveLibrary<double> library;
+  library.generate(dt, num_control_points, headings, climbs, speed_grid);
+
+  if(!library.save(argv[1])) {
+    std::cout << "Could not write " << argv[1] << std::endl;
+    return 1;
+  }
+
+  std::cout << "Wrote " << library.numPrimitives() << " primitives with " << num_control_points
+            << " control points to " << argv[1] << std::endl;
+
+  return 0;
+}
@@ -24,54 +24,78 @@
 #include <ros/ros.h>
 #include <Eigen/Core>
 #include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/PointStamped.h>
 #include <ewok/ed_ring_buffer.h>
-#include <sensor_msgs/Image.h>
 #include <cholmod.h>
 #include <chrono>
-#include <cv_bridge/cv_bridge.h>
 #include <tf/transform_listener.h>
 #include <tf_conversions/tf_eigen.h>
 #include <std_msgs/String.h>
+#include <trajectory_planner/BSplineTrajectory.h>
 
 #include <ewok/polynomial_3d_optimization.h>
 #include <ewok/uniform_bspline_3d_optimization.h>
+#include <ewok/motion_primitive_library.h>
+
+#include "depth_sensor_frontend.h"
 
 
 static const uint8_t POW = 6;
-static const uint8_t subsample = 4;
 static const double dt = 0.5;
 static const int num_opt_points = 7;
 static const double max_velocity = 1.0;
 static const double max_acceleration = 0.5;
 static const double resolution = 0.1;
 static const double distance_threshold = 0.3;
+// A point of interest that is not refreshed for this long is no longer kept in view
+static const double point_of_interest_timeout = 1.0;
 
 bool ringbufferActive = false;
-bool ringbufferInitialized = false;
 bool setpointActive = false;
-bool setpointInitialized = false;
-bool encodingInitialized = false;
-bool encodingFloat = false;
 
 ros::Subscriber local_pos_sub;
 ros::Subscriber endpoint_pos_sub;
-ros::Subscriber depth_cam_sub;
 ros::Subscriber ewok_cmd_sub;
+ros::Subscriber point_of_interest_sub;
 
-ros::Publisher setpoint_pos_pub;
+ros::Publisher trajectory_pub;
 ros::Publisher occ_marker_pub, free_marker_pub, dist_marker_pub, current_traj_marker_pub, traj_marker_pub;
 
 geometry_msgs::PoseStamped endpoint_position;
 geometry_msgs::PoseStamped local_position;
-geometry_msgs::PoseStamped setpoint_pos_ENU;
-sensor_msgs::Image depth_cam_img;
+geometry_msgs::PointStamped point_of_interest;
 
 ewok::PolynomialTrajectory3D<10>::Ptr traj;
-ewok::EuclideanDistanceRingBuffer<POW>::Ptr edrb;
-ewok::UniformBSpline3DOptimization<6>::Ptr spline_optimization;
+typedef ewok::EuclideanDistanceRingBuffer<POW> DistanceBuffer;
+typedef ewok::UniformBSpline3DOptimization<6, double, DistanceBuffer> SplineOptimization;
+
+DistanceBuffer::Ptr edrb;
+DepthSensorFrontend<DistanceBuffer> * depth_sensors;
+SplineOptimization::Ptr spline_optimization;
+ewok::MotionPrimitiveLibrary<double>::Ptr motion_primitives;
 
 tf::TransformListener * listener;
 
+// Plan the yaw along with the position instead of flying with the endpoint yaw
+bool plan_yaw;
+
+// Without a point of interest, the planned yaw follows the horizontal velocity
+// instead of turning to the endpoint yaw
+bool yaw_follows_velocity;
+
+// The trajectory is checked against this distance every tick and replanned
+// immediately when it gets closer to an obstacle
+double min_obstacle_distance;
+
+// Whether the current spline was optimized yet, and with which map version
+bool trajectory_optimized = false;
+uint64_t optimized_map_version;
+
+// Marker camera used by the visibility cost, forward looking in the body frame
+double visibility_fx, visibility_fy, visibility_cx, visibility_cy, visibility_margin;
+int visibility_width, visibility_height;
+Eigen::Vector3d visibility_offset;
+
 void ewok_cmd_cb(const std_msgs::String::ConstPtr& msg)
 {
   if(msg->data == "s")
@@ -108,188 +132,152 @@ void endpoint_position_cb(const geometry_msgs::PoseStamped::ConstPtr& msg)
 
   traj = to.computeTrajectory(path);
 
+  if(edrb)
+  {
+    double collision_time = traj->checkTrajectory(*edrb, min_obstacle_distance, 0, traj->duration());
+    if(collision_time >= 0) ROS_INFO("Straight trajectory blocked after %f s", collision_time);
+  }
+
   visualization_msgs::MarkerArray traj_marker;
   traj->getVisualizationMarkerArray(traj_marker, "gt", Eigen::Vector3d(1,0,1));
   traj_marker_pub.publish(traj_marker);
 
-  spline_optimization.reset(new ewok::UniformBSpline3DOptimization<6>(traj, dt));
+  spline_optimization.reset(new SplineOptimization(traj, dt));
 
-  for (int i = 0; i < num_opt_points; i++) {
-      spline_optimization->addControlPoint(start_point);
+  // Seed with the primitive that gets furthest towards the goal without
+  // collision, or keep the drone at the start point if none gets closer
+  ewok::MotionPrimitiveLibrary<double>::Vector3Array initial_cps;
+  if(motion_primitives && edrb &&
+     motion_primitives->selectBest(*edrb, start_point, end_point, distance_threshold, initial_cps) >= 0)
+  {
+    for (const Eigen::Vector3d & cp : initial_cps) {
+        spline_optimization->addControlPoint(cp);
+    }
+  }
+  else
+  {
+    for (int i = 0; i < num_opt_points; i++) {
+        spline_optimization->addControlPoint(start_point);
+    }
   }
 
   spline_optimization->setNumControlPointsOptimized(num_opt_points);
   spline_optimization->setDistanceBuffer(edrb);
   spline_optimization->setDistanceThreshold(distance_threshold);
   spline_optimization->setLimits(limits);
-
+  spline_optimization->setInitialYaw(tf::getYaw(local_position.pose.orientation));
+  spline_optimization->setTargetYaw(tf::getYaw(endpoint_position.pose.orientation));
+  spline_optimization->setYawFollowsVelocity(yaw_follows_velocity);
+
+  Eigen::Matrix3d R_b_c;
+  R_b_c << 0, 0, 1,
+          -1, 0, 0,
+           0,-1, 0;
+  spline_optimization->setVisibilityCamera(visibility_fx, visibility_fy, visibility_cx, visibility_cy,
+                                           visibility_width, visibility_height, visibility_margin,
+                                           R_b_c, visibility_offset);
+
+  trajectory_optimized = false;
   setpointActive = true;
 }
 
-void depth_cam_cb(const sensor_msgs::Image::ConstPtr& msg)
+void point_of_interest_cb(const geometry_msgs::PointStamped::ConstPtr& msg)
 {
-  if(!encodingInitialized)
+  point_of_interest = *msg;
+}
+
+// Returns whether a point of interest is active
+bool updatePointOfInterest()
+{
+  if(point_of_interest.header.stamp.isZero() ||
+     (ros::Time::now() - point_of_interest.header.stamp).toSec() > point_of_interest_timeout)
   {
-    if(msg->encoding == "32FC1")
-    {
-      encodingFloat = true;
-      ROS_INFO("Depth image encoding: 32FC1");
-    }
-    else if(msg->encoding == "16UC1")
-    {
-      encodingFloat = false;
-      ROS_INFO("Depth image encoding: 16UC1");
-    }
-    else
-    {
-      ROS_INFO("Couldn't get encoding");
-    }
-    encodingInitialized = true;
+    spline_optimization->clearPointOfInterest();
+    return false;
   }
-  if(ringbufferActive)
-  {
-    static const float fx = 457.815979003906;
-    static const float fy = 457.815979003906;
-    static const float cx = 249.322647094727;
-    static const float cy = 179.5;
-
-    tf::StampedTransform transform;
 
-    try
-    {
-      listener->lookupTransform("world", "camera", ros::Time(0), transform);
-    }
-    catch (tf::TransformException &ex)
-    {
-      ROS_INFO("Couldn't get transform");
-      ROS_WARN("%s",ex.what());
-      return;
-    }
-
-    Eigen::Affine3d dT_w_c;
-    tf::transformTFToEigen(transform, dT_w_c);
-
-    Eigen::Affine3f T_w_c = dT_w_c.cast<float>();
-
-    //auto t1 = std::chrono::high_resolution_clock::now();
-
-    ewok::EuclideanDistanceRingBuffer<POW>::PointCloud cloud1;
-
-    for(int v=0; v < msg->height; v+=subsample)
-    {
-      for(int u=0; u < msg->width; u+=subsample)
-      {
-        float val;
-        if(encodingFloat)
-        {
-          val = *(float *)&msg->data[(v*msg->width + u)*4];
-        }
-        else
-        {
-          uint16_t uval = *(uint16_t *)&msg->data[(v*msg->width + u)*2];
-          val = uval/1000.0; //Depth data is represented in mm
-        }
-
-        if(std::isfinite(val) && val > 0.05)
-        {
-          Eigen::Vector4f p;
-          p[0] = val*(u - cx)/fx;
-          p[1] = val*(v - cy)/fy;
-          p[2] = val;
-          p[3] = 1;
-
-          p = T_w_c * p;
-
-          cloud1.push_back(p);
-        }
-      }
-    }
-
-    Eigen::Vector3f origin = (T_w_c * Eigen::Vector4f(0,0,0,1)).head<3>();
-
-    //auto t2 = std::chrono::high_resolution_clock::now();
-
-    if(!ringbufferInitialized)
-    {
-      Eigen::Vector3i idx;
-      edrb->getIdx(origin, idx);
-
-      ROS_INFO_STREAM("Origin: " << origin.transpose() << " idx " << idx.transpose());
-
-      edrb->setOffset(idx);
-
-      ringbufferInitialized = true;
-    }
-    else
-    {
-      Eigen::Vector3i origin_idx, offset, diff;
-      edrb->getIdx(origin, origin_idx);
-
-      offset = edrb->getVolumeCenter();
-      diff = origin_idx - offset;
-
-      while(diff.array().any())
-      {
-        //ROS_INFO("Moving Volume");
-        edrb->moveVolume(diff);
-
-        offset = edrb->getVolumeCenter();
-        diff = origin_idx - offset;
-      }
-    }
-
-    //ROS_INFO_STREAM("cloud1 size: " << cloud1.size());
-
-    //auto t3 = std::chrono::high_resolution_clock::now();
-
-    edrb->insertPointCloud(cloud1, origin);
-
-    //auto t4 = std::chrono::high_resolution_clock::now();
-
-    //f_time << std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count() << " " <<
-    //          std::chrono::duration_cast<std::chrono::nanoseconds>(t3-t2).count() << " " <<
-    //          std::chrono::duration_cast<std::chrono::nanoseconds>(t4-t3).count() << std::endl;
-
-    visualization_msgs::Marker m_occ, m_free;
-    edrb->getMarkerOccupied(m_occ);
-    edrb->getMarkerFree(m_free);
-
-    occ_marker_pub.publish(m_occ);
-    free_marker_pub.publish(m_free);
-  }
+  // The controller flies the trajectory with the endpoint yaw, or the planned
+  // one which is taken as constant from the start of the horizon
+  Eigen::Vector3d point(point_of_interest.point.x, point_of_interest.point.y, point_of_interest.point.z);
+  double yaw = plan_yaw ? spline_optimization->getFirstOptimizationYaw() : tf::getYaw(endpoint_position.pose.orientation);
+  spline_optimization->setPointOfInterest(point, yaw);
+  return true;
 }
 
 void local_position_cb(const geometry_msgs::PoseStamped::ConstPtr& msg)
 {
   local_position = *msg;
-
-  if(!setpointInitialized)
-  {
-    setpoint_pos_ENU = local_position;
-    setpointInitialized = true;
-  }
 }
 
-void publishSetpoint(const ros::TimerEvent& e)
+void publishTrajectory()
 {
-  if(setpointActive)
+  std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d>> cps;
+  spline_optimization->getControlPointsWindow(cps);
+
+  trajectory_planner::BSplineTrajectory trajectory;
+  trajectory.header.stamp = ros::Time::now();
+  trajectory.header.frame_id = "world";
+  trajectory.order = 6;
+  trajectory.dt = dt;
+  trajectory.yaw = tf::getYaw(endpoint_position.pose.orientation);
+
+  trajectory.control_points.resize(cps.size());
+  for(size_t i = 0; i < cps.size(); i++)
   {
-    setpoint_pos_ENU.pose.orientation = endpoint_position.pose.orientation;
-    //ROS_INFO("Publish: %f %f %f", setpoint_pos_ENU.pose.position.x, setpoint_pos_ENU.pose.position.y, setpoint_pos_ENU.pose.position.z);
-    setpoint_pos_pub.publish(setpoint_pos_ENU);
+    trajectory.control_points[i].x = cps[i][0];
+    trajectory.control_points[i].y = cps[i][1];
+    trajectory.control_points[i].z = cps[i][2];
+  }
 
-    ros::spinOnce();
+  if(plan_yaw)
+  {
+    spline_optimization->getYawControlPointsWindow(trajectory.yaw_control_points);
   }
+
+  trajectory_pub.publish(trajectory);
 }
 
 int main(int argc, char** argv)
 {
   ros::init(argc, argv, "collision_avoid");
   ros::NodeHandle nh;
+  ros::NodeHandle pnh("~");
+
+  pnh.param("plan_yaw", plan_yaw, true);
+  pnh.param("yaw_follows_velocity", yaw_follows_velocity, false);
+  pnh.param("min_obstacle_distance", min_obstacle_distance, 0.15);
+
+  // Generated by motion_primitive_generator with the same dt and number of points
+  std::string motion_primitives_file;
+  if(pnh.getParam("motion_primitives", motion_primitives_file))
+  {
+    motion_primitives.reset(new ewok::MotionPrimitiveLibrary<double>);
+    if(!motion_primitives->load(motion_primitives_file) ||
+       motion_primitives->numControlPoints() != num_opt_points || std::abs(motion_primitives->dt() - dt) > 1e-6)
+    {
+      ROS_WARN_STREAM("Could not use motion primitives from " << motion_primitives_file);
+      motion_primitives.reset();
+    }
+  }
+  pnh.param("visibility_fx", visibility_fx, 320.0);
+  pnh.param("visibility_fy", visibility_fy, 320.0);
+  pnh.param("visibility_cx", visibility_cx, 320.0);
+  pnh.param("visibility_cy", visibility_cy, 240.0);
+  pnh.param("visibility_width", visibility_width, 640);
+  pnh.param("visibility_height", visibility_height, 480);
+  pnh.param("visibility_margin", visibility_margin, 40.0);
+  pnh.param("visibility_offset_x", visibility_offset[0], 0.0);
+  pnh.param("visibility_offset_y", visibility_offset[1], 0.0);
+  pnh.param("visibility_offset_z", visibility_offset[2], 0.0);
+
+  // Obstacles that are not observed anymore fade out with this half-life, 0 keeps them forever
+  double occupancy_half_life;
+  pnh.param("occupancy_half_life", occupancy_half_life, 0.0);
 
   local_pos_sub = nh.subscribe<geometry_msgs::PoseStamped>("/mavros/local_position/pose", 10, local_position_cb);
   endpoint_pos_sub = nh.subscribe<geometry_msgs::PoseStamped>("/trajectory/endpoint_position", 10, endpoint_position_cb);
   ewok_cmd_sub = nh.subscribe<std_msgs::String>("/trajectory/command", 10, ewok_cmd_cb);
+  point_of_interest_sub = nh.subscribe<geometry_msgs::PointStamped>("/trajectory/point_of_interest", 10, point_of_interest_cb);
 
   listener = new tf::TransformListener;
 
@@ -305,23 +293,41 @@ int main(int argc, char** argv)
     ros::Duration(0.05).sleep();
   }
 
-  depth_cam_sub = nh.subscribe<sensor_msgs::Image>("/camera/depth/image_raw", 1, depth_cam_cb);
-
-  setpoint_pos_pub = nh.advertise<geometry_msgs::PoseStamped>("/trajectory/setpoint_position", 10);
+  depth_sensors = new DepthSensorFrontend<DistanceBuffer>(nh, pnh, *listener);
 
-  edrb.reset(new ewok::EuclideanDistanceRingBuffer<POW>(resolution, 1.0));
+  trajectory_pub = nh.advertise<trajectory_planner::BSplineTrajectory>("/trajectory/bspline", 10);
 
-  // The setpoint publishing rate MUST be faster than 2Hz
-  ros::Timer timer = nh.createTimer(ros::Duration(0.05), publishSetpoint);
+  edrb.reset(new DistanceBuffer(resolution, 1.0));
+  edrb->setDecayHalfLife(occupancy_half_life);
 
-  // Trigger callback functions at the following rate
-  ros::Rate r(dt);
+  // Replan once per spline segment, the controller samples the published
+  // trajectory in between
+  ros::Rate r(1.0/dt);
   while(ros::ok())
   {
     ros::spinOnce();
 
     //auto t1 = std::chrono::high_resolution_clock::now();
 
+    // All sensors are inserted at once, so that the distances are computed
+    // only once per tick
+    if(ringbufferActive)
+    {
+      if(depth_sensors->flush(*edrb) > 0)
+      {
+        visualization_msgs::Marker m_occ, m_free;
+        edrb->getMarkerOccupied(m_occ);
+        edrb->getMarkerFree(m_free);
+
+        occ_marker_pub.publish(m_occ);
+        free_marker_pub.publish(m_free);
+      }
+    }
+    else
+    {
+      depth_sensors->clear();
+    }
+
     edrb->updateDistance();
 
     visualization_msgs::MarkerArray traj_marker;
@@ -329,23 +335,42 @@ int main(int argc, char** argv)
     //auto t2 = std::chrono::high_resolution_clock::now();
     if(setpointActive)
     {
-      spline_optimization->optimize();
+      bool point_of_interest_active = updatePointOfInterest();
+
+      // Early exit: the sphere traced check stops at the first collision, and
+      // is all that runs while the map and the targets stay the same
+      double collision_time = spline_optimization->checkTrajectory(min_obstacle_distance);
+      if(collision_time >= 0)
+      {
+        ROS_WARN("Trajectory in collision after %f s, replanning", collision_time);
+      }
+
+      if(!trajectory_optimized || collision_time >= 0 || point_of_interest_active ||
+         edrb->getVersion() != optimized_map_version || !spline_optimization->isConverged(0.01))
+      {
+        spline_optimization->optimize();
+        if(plan_yaw) spline_optimization->optimizeYaw();
+
+        trajectory_optimized = true;
+        optimized_map_version = edrb->getVersion();
+
+        if(collision_time >= 0 && spline_optimization->checkTrajectory(min_obstacle_distance) >= 0)
+        {
+          ROS_WARN("Replanned trajectory still in collision");
+        }
+      }
       //auto t3 = std::chrono::high_resolution_clock::now();
 
       //opt_time << std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count() << " "
       //    << std::chrono::duration_cast<std::chrono::nanoseconds>(t3-t2).count() << std::endl;
 
-      Eigen::Vector3d pc = spline_optimization->getFirstOptimizationPoint();
-
-      setpoint_pos_ENU.pose.position.x = pc[0];
-      setpoint_pos_ENU.pose.position.y = pc[1];
-      setpoint_pos_ENU.pose.position.z = pc[2];
+      publishTrajectory();
 
       spline_optimization->getMarkers(traj_marker);
       current_traj_marker_pub.publish(traj_marker);
 
       spline_optimization->addLastControlPoint();
-\
+
       visualization_msgs::Marker m_dist;
       edrb->getMarkerDistance(m_dist, 0.5);
       dist_marker_pub.publish(m_dist);
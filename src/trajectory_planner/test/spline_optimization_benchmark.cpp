@@ -0,0 +1,110 @@
+/**
+* This file is part of Ewok.
+*
+* Copyright 2017 Vladyslav Usenko, Technical University of Munich.
+* Developed by Vladyslav Usenko <vlad dot usenko at tum dot de>,
+* for more information see <http://vision.in.tum.de/research/robotvision/replanning>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* Ewok is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* Ewok is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with Ewok. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Times every cost term of UniformBSpline3DOptimization, with its analytic
+// gradient, on randomized maps and splines.
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "spline_optimization_fixture.h"
+
+using ewok::test::SplineOptimization;
+
+static const int num_problems = 8;
+static const int num_perturbations = 16;
+
+// Problems shared by all benchmarks, so that every term is timed on the same splines
+static const std::vector<SplineOptimization::Ptr> & problems() {
+  static std::vector<SplineOptimization::Ptr> problems;
+  if(problems.empty()) {
+    ewok::test::RandomSplineProblems generator;
+    for(int i = 0; i < num_problems; i++) {
+      problems.push_back(generator.randomProblem());
+    }
+  }
+  return problems;
+}
+
+template<typename F>
+static void runTerm(benchmark::State &state, F term) {
+  const std::vector<SplineOptimization::Ptr> & spline_opts = problems();
+  std::vector<double> grad;
+  size_t i = 0;
+
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(term(*spline_opts[i++ % spline_opts.size()], grad));
+  }
+}
+
+static void BM_EndpointError(benchmark::State &state) {
+  int deriv = state.range(0);
+  runTerm(state, [=](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticEndpointErrorGrad(g, deriv); });
+}
+BENCHMARK(BM_EndpointError)->Arg(0)->Arg(1);
+
+static void BM_QuadraticError(benchmark::State &state) {
+  runTerm(state, [](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticQuadraticErrorGrad(g); });
+}
+BENCHMARK(BM_QuadraticError);
+
+// The optimizer moves every control point between evaluations, so the spline is
+// perturbed on every call and the per-segment cache is always outdated
+static void BM_CollisionError(benchmark::State &state) {
+  ewok::test::RandomSplineProblems generator(1);
+  const std::vector<SplineOptimization::Ptr> & spline_opts = problems();
+
+  std::vector<std::vector<double>> perturbed(spline_opts.size() * num_perturbations);
+  for(size_t i = 0; i < perturbed.size(); i++) {
+    spline_opts[i / num_perturbations]->getOptimizedControlPoints(perturbed[i]);
+    for(double & x : perturbed[i]) x += generator.uniform(-0.05, 0.05);
+  }
+
+  std::vector<double> grad;
+  size_t i = 0;
+  for(auto _ : state) {
+    size_t idx = i++ % perturbed.size();
+    benchmark::DoNotOptimize(spline_opts[idx / num_perturbations]->getCollisionErrorGrad(perturbed[idx], grad));
+  }
+}
+BENCHMARK(BM_CollisionError);
+
+// Unchanged control points, only the cache lookup
+static void BM_CollisionErrorCached(benchmark::State &state) {
+  runTerm(state, [](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticCollisionErrorGrad(g); });
+}
+BENCHMARK(BM_CollisionErrorCached);
+
+static void BM_SoftLimitError(benchmark::State &state) {
+  int deriv = state.range(0);
+  runTerm(state, [=](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticSoftLimitErrorGrad(g, deriv); });
+}
+BENCHMARK(BM_SoftLimitError)->DenseRange(1, 2);
+
+static void BM_VisibilityError(benchmark::State &state) {
+  runTerm(state, [](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticVisibilityErrorGrad(g); });
+}
+BENCHMARK(BM_VisibilityError);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,158 @@
+/**
+* This file is part of Ewok.
+*
+* Copyright 2017 Vladyslav Usenko, Technical University of Munich.
+* Developed by Vladyslav Usenko <vlad dot usenko at tum dot de>,
+* for more information see <http://vision.in.tum.de/research/robotvision/replanning>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* Ewok is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* Ewok is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with Ewok. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Randomized maps and splines for the UniformBSpline3DOptimization gradient
+// tests and cost term benchmarks.
+
+#ifndef EWOK_SPLINE_OPTIMIZATION_FIXTURE_H_
+#define EWOK_SPLINE_OPTIMIZATION_FIXTURE_H_
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <ewok/uniform_bspline_3d_optimization.h>
+
+namespace ewok {
+namespace test {
+
+typedef EuclideanDistanceRingBuffer<6> DistanceBuffer;
+
+static const double dt = 0.5;
+static const int num_opt_points = 7;
+static const double resolution = 0.1;
+static const int num_obstacles = 8;
+
+// Exposes the collision cost on arbitrary values of the optimized control
+// points, as the optimizer evaluates it
+class SplineOptimization : public UniformBSpline3DOptimization<6> {
+ public:
+  typedef std::shared_ptr<SplineOptimization> Ptr;
+
+  SplineOptimization(const Vector3 &start_point, double dt) :
+      UniformBSpline3DOptimization<6>(start_point, dt) {}
+
+  void getOptimizedControlPoints(std::vector<double> &x) const {
+    x.resize(3*num_cp_opt);
+    spline_.getControlPointsData(x, cp_opt_start_idx, num_cp_opt);
+  }
+
+  double getCollisionErrorGrad(const std::vector<double> &x, std::vector<double> &grad) const {
+    UniformBSpline3D<6, double> current_spline(spline_);
+    current_spline.setControlPointsData(x, cp_opt_start_idx, num_cp_opt);
+
+    grad.resize(3*num_cp_opt);
+    std::fill(grad.begin(), grad.end(), 0.0);
+
+    return collisionError(current_spline, 1.0, grad);
+  }
+};
+
+// Builds reproducible problems in which every cost term is active most of
+// the time: box surfaces in the distance buffer, a random walk of control
+// points through them, targets, tight soft limits and a point of interest
+class RandomSplineProblems {
+ public:
+  RandomSplineProblems(unsigned seed = 0) : rng_(seed) {}
+
+  double uniform(double min, double max) {
+    return std::uniform_real_distribution<double>(min, max)(rng_);
+  }
+
+  Eigen::Vector3d uniformVector(double min, double max) {
+    return Eigen::Vector3d(uniform(min, max), uniform(min, max), uniform(min, max));
+  }
+
+  DistanceBuffer::Ptr randomMap() {
+    DistanceBuffer::Ptr edrb(new DistanceBuffer(resolution, 1.0));
+    edrb->setOffset(DistanceBuffer::Vector3i(-DistanceBuffer::_N/2, -DistanceBuffer::_N/2, -DistanceBuffer::_N/2));
+
+    DistanceBuffer::PointCloud cloud;
+    for(int i = 0; i < num_obstacles; i++) {
+      Eigen::Vector3d center = uniformVector(-2, 2), size = uniformVector(0.2, 1.0);
+      Eigen::Vector3d min = center - size/2, max = center + size/2;
+
+      for(double x = min[0]; x <= max[0]; x += resolution/2) {
+        for(double y = min[1]; y <= max[1]; y += resolution/2) {
+          for(double z = min[2]; z <= max[2]; z += resolution/2) {
+            if(x - min[0] < resolution/2 || max[0] - x < resolution/2 ||
+               y - min[1] < resolution/2 || max[1] - y < resolution/2 ||
+               z - min[2] < resolution/2 || max[2] - z < resolution/2) {
+              cloud.push_back(Eigen::Vector4f(x, y, z, 1));
+            }
+          }
+        }
+      }
+    }
+
+    // Seen from the origin often enough to become occupied
+    for(int i = 0; i < 4; i++) {
+      edrb->insertPointCloud(cloud, Eigen::Vector3f(0, 0, 0));
+    }
+    edrb->updateDistance();
+
+    return edrb;
+  }
+
+  SplineOptimization::Ptr randomSpline(const DistanceBuffer::Ptr &edrb) {
+    SplineOptimization::Ptr spline_opt(new SplineOptimization(Eigen::Vector3d(0, 0, 0), dt));
+
+    Eigen::Vector3d point = uniformVector(-1, 1);
+    for(int i = 0; i < num_opt_points; i++) {
+      point += uniformVector(-0.4, 0.4);
+      spline_opt->addControlPoint(point);
+    }
+
+    spline_opt->setNumControlPointsOptimized(num_opt_points);
+    spline_opt->setDistanceBuffer(edrb);
+    spline_opt->setLimits(Eigen::Vector4d(0.3, 0.5, 0, 0));
+    spline_opt->setTargetEnpoint(point + uniformVector(-1, 1));
+    spline_opt->setTargetEnpointVelocity(uniformVector(-0.5, 0.5));
+    spline_opt->setPointOfInterest(point + uniformVector(-3, 3), uniform(-M_PI, M_PI));
+
+    return spline_opt;
+  }
+
+  SplineOptimization::Ptr randomProblem() {
+    return randomSpline(randomMap());
+  }
+
+ private:
+  std::mt19937 rng_;
+};
+
+// Norm of the difference relative to the numeric gradient, or absolute if that is small
+inline double relativeError(const std::vector<double> &analytic, const std::vector<double> &numeric) {
+  double diff = 0, norm = 0;
+  for(size_t i = 0; i < analytic.size(); i++) {
+    diff += (analytic[i] - numeric[i]) * (analytic[i] - numeric[i]);
+    norm += numeric[i] * numeric[i];
+  }
+  return std::sqrt(diff) / std::max(std::sqrt(norm), 1.0);
+}
+
+}  // namespace test
+}  // namespace ewok
+
+#endif  // EWOK_SPLINE_OPTIMIZATION_FIXTURE_H_
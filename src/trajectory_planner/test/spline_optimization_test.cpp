@@ -0,0 +1,108 @@
+/**
+* This file is part of Ewok.
+*
+* Copyright 2017 Vladyslav Usenko, Technical University of Munich.
+* Developed by Vladyslav Usenko <vlad dot usenko at tum dot de>,
+* for more information see <http://vision.in.tum.de/research/robotvision/replanning>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* Ewok is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* Ewok is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with Ewok. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the analytic gradient of every cost term of UniformBSpline3DOptimization
+// against central differences on randomized maps and splines.
+
+#include <functional>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "spline_optimization_fixture.h"
+
+using ewok::test::SplineOptimization;
+
+typedef std::function<double(const SplineOptimization &, std::vector<double> &)> GradientFunction;
+
+class SplineOptimizationGradientTest : public ::testing::Test {
+ protected:
+  static constexpr int num_trials = 20;
+
+  // The term has to be active in some of the trials for the check to mean anything
+  void checkGradient(const GradientFunction &analytic, const GradientFunction &numeric, double tolerance) {
+    ewok::test::RandomSplineProblems problems;
+    std::vector<double> analytic_grad, numeric_grad;
+    int num_active = 0;
+
+    for(int trial = 0; trial < num_trials; trial++) {
+      SplineOptimization::Ptr spline_opt = problems.randomProblem();
+
+      double value = analytic(*spline_opt, analytic_grad);
+      numeric(*spline_opt, numeric_grad);
+
+      if(value > 0) num_active++;
+      EXPECT_LE(ewok::test::relativeError(analytic_grad, numeric_grad), tolerance) << "trial " << trial;
+    }
+
+    EXPECT_GT(num_active, num_trials/4);
+  }
+};
+
+TEST_F(SplineOptimizationGradientTest, EndpointPosition) {
+  checkGradient([](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticEndpointErrorGrad(g, 0); },
+                [](const SplineOptimization & o, std::vector<double> & g) { return o.getNumericEndpointErrorGrad(g, 0); },
+                1e-4);
+}
+
+TEST_F(SplineOptimizationGradientTest, EndpointVelocity) {
+  checkGradient([](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticEndpointErrorGrad(g, 1); },
+                [](const SplineOptimization & o, std::vector<double> & g) { return o.getNumericEndpointErrorGrad(g, 1); },
+                1e-4);
+}
+
+TEST_F(SplineOptimizationGradientTest, Quadratic) {
+  checkGradient([](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticQuadraticErrorGrad(g); },
+                [](const SplineOptimization & o, std::vector<double> & g) { return o.getNumericQuadraticErrorGrad(g); },
+                1e-4);
+}
+
+// The distance field is only piecewise trilinear, its gradient jumps between voxels
+TEST_F(SplineOptimizationGradientTest, Collision) {
+  checkGradient([](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticCollisionErrorGrad(g); },
+                [](const SplineOptimization & o, std::vector<double> & g) { return o.getNumericCollisionErrorGrad(g); },
+                5e-2);
+}
+
+TEST_F(SplineOptimizationGradientTest, SoftLimitVelocity) {
+  checkGradient([](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticSoftLimitErrorGrad(g, 1); },
+                [](const SplineOptimization & o, std::vector<double> & g) { return o.getNumericSoftLimitErrorGrad(g, 1); },
+                1e-3);
+}
+
+TEST_F(SplineOptimizationGradientTest, SoftLimitAcceleration) {
+  checkGradient([](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticSoftLimitErrorGrad(g, 2); },
+                [](const SplineOptimization & o, std::vector<double> & g) { return o.getNumericSoftLimitErrorGrad(g, 2); },
+                1e-3);
+}
+
+TEST_F(SplineOptimizationGradientTest, Visibility) {
+  checkGradient([](const SplineOptimization & o, std::vector<double> & g) { return o.getAnalyticVisibilityErrorGrad(g); },
+                [](const SplineOptimization & o, std::vector<double> & g) { return o.getNumericVisibilityErrorGrad(g); },
+                1e-3);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -4,6 +4,8 @@
 #cmakedefine ENABLE_FULL_UNDISTORT
 #cmakedefine ENABLE_RANDOMIZED_THRESHOLD
 #cmakedefine ENABLE_VERBOSE
+#cmakedefine ENABLE_FLOAT_POSE
+#cmakedefine ENABLE_ALLOCATION_COUNTER
 
 #if defined(ENABLE_VERBOSE)
 #define WHYCON_DEBUG(x) cout << x << endl
@@ -11,12 +11,13 @@
 #include <vector>
 #include <whycon/config.h>
 #include <unordered_set>
+#include <climits>
 
 namespace whycon {
   struct DetectorParameters
   {
     int min_size = 10;
-    int max_size = 100 * 100;
+    int max_size = 300 * 300;
     double center_distance_tolerance_ratio = 0.1;
     double center_distance_tolerance_abs = 5;
     double roundness_tolerance = 0.3;
@@ -25,6 +26,17 @@ namespace whycon {
     double inner_diameter = 0.050;
     double outer_diameter = 0.122;    
     double max_eccentricity = 1.0;
+
+    /* largest expected marker diameter in pixels, segments outgrowing it are abandoned early while no target is tracked
+     * (0: the image size). LocalizationSystem derives it from outer_diameter and the focal length if min_distance, the
+     * closest working distance in meters, is set */
+    int max_apparent_diameter = 0;
+    double min_distance = 0;
+
+    /* WhyCode-style identification: id_bits black teeth/white gaps along the inner edge of the ring (0 disables),
+     * sampled on an ellipse at id_sampling_ratio times the inner radius */
+    int id_bits = 0;
+    double id_sampling_ratio = 0.75;
   };
 
   class CircleDetector
@@ -41,6 +53,7 @@ namespace whycon {
       void cover_last_detected(cv::Mat& image);
       
       int get_threshold(void) const;
+      int decode_id(const cv::Mat& image, const Circle& circle);
 
     private:
     
@@ -52,6 +65,12 @@ namespace whycon {
       int thresholdStep;
       int threshold, threshold_counter;
       void change_threshold(void);
+
+      /* per-target threshold state: brightness of the inner (white) and outer (black) regions of the last detection,
+       * while the target is lost the threshold is searched deterministically around their midpoint */
+      bool threshold_tracking;
+      int last_inner_mean, last_outer_mean;
+      int lost_counter;
       inline int threshold_pixel(uchar* ptr);
 
       int queueStart,queueEnd,queueOldStart,numSegments;
@@ -59,6 +78,7 @@ namespace whycon {
       bool use_local_window;
       float local_window_multiplier;
       int local_window_width, local_window_height, local_window_x, local_window_y;
+      int expected_max_width, expected_max_height; // segments with a larger bounding box are not examined further
 
       Context* context;
       int detector_id, BLACK, WHITE, UNKNOWN;
@@ -66,6 +86,11 @@ namespace whycon {
 
       inline bool is_unclassified(int pixel_class);
 
+      static const int MAX_ID_BITS = 16;
+      static const int ID_SAMPLES_PER_BIT = 8;
+      static const int ID_FIXED_POINT_BITS = 10;
+      std::vector<int> id_cos, id_sin; // sampling angles in fixed point
+
     public:
       class Circle {
         public:
@@ -80,6 +105,7 @@ namespace whycon {
           bool round, valid;
           float m0,m1; // axis dimensions
           float v0,v1; // axis (v0,v1) and (v1,-v0)
+          int id; // -1 if not decoded
 
           void write(cv::FileStorage& fs) const;
           void read(const cv::FileNode& node);
@@ -98,6 +124,11 @@ namespace whycon {
           void cleanup_buffer(const Circle& c);
           void reset(void);
 
+          /* marks the pixels on the image border, which are never examined by any detector, so that the
+           * flood fill does not need to check neighbours against the image bounds */
+          void mark_border(void);
+          static const int BORDER = INT_MAX;
+
           std::vector<int> buffer, queue;
           int width, height;
 
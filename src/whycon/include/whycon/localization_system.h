@@ -19,7 +19,12 @@ namespace whycon {
       };
       
       Pose get_pose(int id) const;
-      Pose get_pose(const CircleDetector::Circle& circle) const;
+      /* row_rotation is the camera rotation (rad, camera frame) during the readout of one image row of a rolling shutter
+       * camera, the ellipse is then corrected to the time its center row was read */
+      Pose get_pose(const CircleDetector::Circle& circle, const cv::Vec3d& row_rotation = cv::Vec3d(0, 0, 0)) const;
+
+      /* get_pose() in the given precision (float or double), get_pose() uses float if ENABLE_FLOAT_POSE is set */
+      template <typename T> Pose compute_pose(const CircleDetector::Circle& circle, const cv::Vec3d& row_rotation = cv::Vec3d(0, 0, 0)) const;
       const CircleDetector::Circle& get_circle(int id);
       
       ManyCircleDetector detector;
@@ -31,8 +36,11 @@ namespace whycon {
       float circle_diameter;
       double fc[2]; // focal length X,Y
       double cc[2]; // principal point X,Y
-      double kc[6]; // distortion coefficients
-      void transform(double x_in, double y_in, double& x_out, double& y_out) const;
+      double kc[13]; // 1, then k1 k2 p1 p2 [k3 [k4 k5 k6 [s1 s2 s3 s4]]] as in dist_coeff, missing ones are 0
+      bool tilted; // 14 coefficient model with a tilted sensor, undistorted with cv::undistortPoints
+      template <typename T> void transform(T x_in, T y_in, T& x_out, T& y_out) const;
+
+      static const int UNDISTORT_ITERATIONS = 5; // as in cv::undistortPoints
 
       void precompute_undistort_map(void);
       cv::Mat undistort_map;
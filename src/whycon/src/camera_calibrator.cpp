@@ -2,8 +2,26 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <iostream>
 #include <vector>
+#include <deque>
+#include <limits>
+#include <cfloat>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
 using namespace std;
 
+/* corners are searched on a downscaled copy of wider frames and only refined on the full resolution image */
+const int DETECTION_WIDTH = 640;
+
+/* views whose corners moved less than this fraction of the image diagonal (on average) w.r.t. an accepted view are rejected */
+const float MIN_VIEW_DIFFERENCE = 0.03;
+
+/* the calibration is updated in the background after every accepted view, warm-started from the previous one */
+const size_t MIN_CALIBRATION_VIEWS = 3;
+const int INCREMENTAL_ITERATIONS = 20;
+const int FINAL_ITERATIONS = 100;
+
 bool stop = false;
 void interrupt(int s) {
   stop = true;
@@ -15,97 +33,306 @@ void mouse_callback(int event, int x, int y, int flags, void* param) {
   if (event == CV_EVENT_RBUTTONDOWN) rclicked = true;
 }
 
+struct Detection {
+  size_t index;
+  cv::Mat frame;
+  vector<cv::Point2f> corners;
+  bool found;
+};
+
+struct Calibration {
+  Calibration(void) : error(0), views(0) {}
+  cv::Mat K, dist_coeff;
+  double error;
+  size_t views;
+};
+
+bool find_corners(const cv::Mat& frame, cv::Size pattern_size, vector<cv::Point2f>& corners)
+{
+  cv::Mat gray;
+  if (frame.channels() == 3) cv::cvtColor(frame, gray, CV_BGR2GRAY);
+  else gray = frame;
+
+  float scale = 1;
+  cv::Mat small = gray;
+  if (gray.cols > DETECTION_WIDTH) {
+    scale = (float)gray.cols / DETECTION_WIDTH;
+    cv::resize(gray, small, cv::Size(), 1 / scale, 1 / scale, cv::INTER_AREA);
+  }
+
+  if (!cv::findChessboardCorners(small, pattern_size, corners, CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_NORMALIZE_IMAGE | CV_CALIB_CB_FAST_CHECK))
+    return false;
+
+  /* map pixel centers of the downscaled image back to the full resolution one */
+  for (size_t i = 0; i < corners.size(); i++)
+    corners[i] = cv::Point2f((corners[i].x + 0.5f) * scale - 0.5f, (corners[i].y + 0.5f) * scale - 0.5f);
+
+  cv::cornerSubPix(gray, corners, cv::Size(11, 11), cv::Size(-1, -1), cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 100, 0.05));
+  return true;
+}
+
+/* Runs find_corners() on a pool of worker threads. Results are returned in completion order. */
+class DetectorPool {
+  public:
+    DetectorPool(cv::Size _pattern_size, int workers) : pattern_size(_pattern_size), in_flight(0), finished(false)
+    {
+      for (int i = 0; i < workers; i++) threads.push_back(thread(&DetectorPool::work, this));
+    }
+
+    ~DetectorPool(void)
+    {
+      { lock_guard<mutex> lock(m); finished = true; }
+      job_available.notify_all();
+      for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+    }
+
+    /* when all workers are busy, either waits for one or drops the frame (returns false) */
+    bool push(size_t index, const cv::Mat& frame, bool wait)
+    {
+      unique_lock<mutex> lock(m);
+      if (jobs.size() >= threads.size()) {
+        if (!wait) return false;
+        job_taken.wait(lock, [this] { return jobs.size() < threads.size(); });
+      }
+
+      Detection d;
+      d.index = index;
+      d.frame = frame;
+      d.found = false;
+      jobs.push_back(d);
+      in_flight++;
+      job_available.notify_one();
+      return true;
+    }
+
+    /* if wait is set, blocks until a result is available or all frames were processed */
+    bool pop(Detection& d, bool wait)
+    {
+      unique_lock<mutex> lock(m);
+      if (wait) result_available.wait(lock, [this] { return !results.empty() || in_flight == 0; });
+      if (results.empty()) return false;
+      d = results.front();
+      results.pop_front();
+      return true;
+    }
+
+  private:
+    void work(void)
+    {
+      while (true) {
+        Detection d;
+        {
+          unique_lock<mutex> lock(m);
+          job_available.wait(lock, [this] { return finished || !jobs.empty(); });
+          if (finished) return;
+          d = jobs.front();
+          jobs.pop_front();
+        }
+        job_taken.notify_one();
+
+        d.found = find_corners(d.frame, pattern_size, d.corners);
+
+        {
+          lock_guard<mutex> lock(m);
+          results.push_back(d);
+          in_flight--;
+        }
+        result_available.notify_one();
+      }
+    }
+
+    cv::Size pattern_size;
+    vector<thread> threads;
+    deque<Detection> jobs, results;
+    size_t in_flight;
+    bool finished;
+    mutex m;
+    condition_variable job_available, job_taken, result_available;
+};
+
+/* average corner displacement w.r.t. the closest view, the board may be detected with its corners in reverse order */
+float view_difference(const vector<cv::Point2f>& corners, const vector< vector<cv::Point2f> >& views)
+{
+  float min_difference = numeric_limits<float>::max();
+  size_t n = corners.size();
+  for (size_t v = 0; v < views.size(); v++) {
+    float difference = 0, difference_reversed = 0;
+    for (size_t i = 0; i < n; i++) {
+      difference += cv::norm(corners[i] - views[v][i]);
+      difference_reversed += cv::norm(corners[i] - views[v][n - 1 - i]);
+    }
+    min_difference = min(min_difference, min(difference, difference_reversed) / n);
+  }
+  return min_difference;
+}
+
+Calibration calibrate(const vector< vector<cv::Point2f> >& views, const vector<cv::Point3f>& grid3d, cv::Size image_size,
+                      const Calibration& guess, int iterations)
+{
+  vector< vector<cv::Point3f> > grid3d_all(views.size(), grid3d);
+  vector<cv::Mat> rotations, translations;
+
+  Calibration calibration;
+  calibration.views = views.size();
+  int flags = 0;
+  if (!guess.K.empty()) {
+    calibration.K = guess.K.clone();
+    calibration.dist_coeff = guess.dist_coeff.clone();
+    flags = CV_CALIB_USE_INTRINSIC_GUESS;
+  }
+  calibration.error = cv::calibrateCamera(grid3d_all, views, image_size, calibration.K, calibration.dist_coeff, rotations, translations, flags,
+                                          cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, iterations, DBL_EPSILON));
+  return calibration;
+}
+
 int main(int argc, char** argv) {
   if (argc != 9) {
-    cout << "usage: camera_calibrator <width> <height> <squares in X> <squares in Y> <square X size [mm]> <square Y size [mm]> [-cam <camera ID> | -img <img pattern>]" << endl;
+    cout << "usage: camera_calibrator <width> <height> <squares in X> <squares in Y> <square X size [mm]> <square Y size [mm]> [-cam <camera ID> | -img <img pattern> | -dir <img directory>]" << endl;
     cout << "X,Y corresponds to width,height in image" << endl;
+    cout << "-dir runs without GUI on all images of the directory" << endl;
     return 1;
   }
-  
+
   /* setup camera */
   int width = atoi(argv[1]);
   int height = atoi(argv[2]);
 
-  bool is_camera = (string(argv[7]) == "-cam");
+  string mode(argv[7]);
+  bool is_camera = (mode == "-cam");
+  bool headless = (mode == "-dir");
   cv::VideoCapture capture;
+  vector<cv::String> files;
   if (is_camera) {
-    capture.open(atoi(argv[7]));
+    capture.open(atoi(argv[8]));
     capture.set(CV_CAP_PROP_FRAME_WIDTH, width);
     capture.set(CV_CAP_PROP_FRAME_HEIGHT, height);
     capture.set(CV_CAP_PROP_FPS, 20);
   }
-  else {
+  else if (mode == "-img") {
     capture.open(argv[8]);
   }
-  if (!capture.isOpened()) { cout << "error opening input source" << endl; return 1; }
-    
+  else if (headless) {
+    cv::glob(string(argv[8]) + "/*", files);
+    if (files.empty()) { cout << "no images found in " << argv[8] << endl; return 1; }
+  }
+  else { cout << "unknown input source " << mode << endl; return 1; }
+  if (!headless && !capture.isOpened()) { cout << "error opening input source" << endl; return 1; }
+
   /* load calibration and setup system */
   cv::Mat frame;
-  cv::Mat K, dist_coeff;
-  
+
   /* setup gui and start capturing / processing */
-  cvStartWindowThread();
-  cv::namedWindow("input");
-  cv::setMouseCallback("input", mouse_callback);
-  
+  if (!headless) {
+    cvStartWindowThread();
+    cv::namedWindow("input");
+    cv::setMouseCallback("input", mouse_callback);
+  }
+
   int x_squares = atoi(argv[3]);
   int y_squares = atoi(argv[4]);
   float x_size = atof(argv[5]);
   float y_size = atof(argv[6]);
   cv::Size pattern_size(x_squares - 1, y_squares - 1);
   vector< vector<cv::Point2f> > all_corners;
-  
+
   vector<cv::Point3f> grid3d;
   for(int i = 0; i < (x_squares - 1) * (y_squares - 1); i++)
     grid3d.push_back(cv::Point3f((i / (x_squares - 1)) * x_size, (i % (x_squares - 1)) * y_size, 0.0f)); // TODO: set units here
-  
-  while (true) {    
-    bool last_frame = capture.grab();
-    capture.retrieve(frame);
-
-    vector<cv::Point2f> corners;
-    int result = cv::findChessboardCorners(frame, pattern_size, corners, CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_NORMALIZE_IMAGE);
-    if (result) {
-      cv::Mat gray;
-      cv::cvtColor(frame, gray, CV_BGR2GRAY);
-      cv::cornerSubPix(gray, corners, cv::Size(11, 11), cv::Size(-1, -1), cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 100, 0.05));
-      cv::drawChessboardCorners(frame, pattern_size, cv::Mat(corners), result);
-      
-      if (!is_camera || clicked) {
-        clicked = false;
-        all_corners.push_back(corners);
-      }
+
+  int workers = max(1u, thread::hardware_concurrency());
+  DetectorPool pool(pattern_size, workers);
+
+  cv::Size image_size;
+  Calibration current;
+  future<Calibration> pending;
+
+  auto process = [&](const Detection& d) {
+    if (!d.found) return;
+
+    float min_difference = MIN_VIEW_DIFFERENCE * sqrt(d.frame.cols * d.frame.cols + d.frame.rows * d.frame.rows);
+    if (!all_corners.empty() && view_difference(d.corners, all_corners) < min_difference) {
+      cout << "frame " << d.index << " rejected, too similar to an accepted view" << endl;
+      return;
+    }
+
+    all_corners.push_back(d.corners);
+    image_size = d.frame.size();
+    cout << "frame " << d.index << " accepted, views: " << all_corners.size() << endl;
+  };
+
+  auto update_calibration = [&](void) {
+    if (pending.valid() && pending.wait_for(chrono::seconds(0)) == future_status::ready) {
+      current = pending.get();
+      cout << "views: " << current.views << ", reprojection error: " << current.error << endl;
     }
-    
-    if (!all_corners.empty() && ((is_camera && rclicked) || (!is_camera && last_frame))) {
-      rclicked = false;
-      vector< vector<cv::Point3f> > grid3d_all(all_corners.size(), grid3d);
-      vector<cv::Mat> rotations, translations;
-      int flags = 0;
-      for (int i = 0; i < 5; i++) {
-        cout << "iteration " << i << endl;
-        double error = cv::calibrateCamera(grid3d_all, all_corners, frame.size(), K, dist_coeff, rotations, translations, flags);
-        cout << "K: " << K << endl;
-        cout << "dist: " << dist_coeff << endl;
-        cout << "reprojection error: " << error << endl;
-        flags = CV_CALIB_USE_INTRINSIC_GUESS;
+    if (!pending.valid() && all_corners.size() >= MIN_CALIBRATION_VIEWS && current.views < all_corners.size())
+      pending = async(launch::async, calibrate, all_corners, grid3d, image_size, current, INCREMENTAL_ITERATIONS);
+  };
+
+  Detection d, last;
+  last.found = false;
+
+  if (headless) {
+    for (size_t i = 0; i < files.size(); i++) {
+      cv::Mat image = cv::imread(files[i]);
+      if (image.empty()) { cout << "could not read " << files[i] << endl; continue; }
+      pool.push(i, image, true);
+
+      while (pool.pop(d, false)) process(d);
+      update_calibration();
+    }
+  }
+  else {
+    size_t index = 0;
+    while (capture.grab()) {
+      capture.retrieve(frame);
+
+      /* live frames are dropped while all workers are busy */
+      pool.push(index++, frame.clone(), !is_camera);
+
+      while (pool.pop(d, false)) {
+        if (!d.found) continue;
+        last = d;
+        if (!is_camera || clicked) {
+          clicked = false;
+          process(d);
+        }
+      }
+      update_calibration();
+
+      if (is_camera && rclicked) {
+        rclicked = false;
+        if (all_corners.size() >= MIN_CALIBRATION_VIEWS) break;
+        cout << "at least " << MIN_CALIBRATION_VIEWS << " views are required" << endl;
       }
-      
-      cv::FileStorage file("calibration.xml", cv::FileStorage::WRITE);
-      file << "K" << K;
-      file << "dist" << dist_coeff;
-      return 0;
+
+      if (last.found && index - last.index <= (size_t)workers)
+        cv::drawChessboardCorners(frame, pattern_size, cv::Mat(last.corners), true);
+
+      ostringstream ostr;
+      ostr << "frames: " << all_corners.size();
+      if (current.views > 0) ostr << " error: " << current.error;
+      cv::putText(frame, ostr.str(), cv::Point(5, 15), CV_FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255,0,255), 1.5, CV_AA);
+
+      if (!frame.empty()) cv::imshow("input", frame);
     }
-    
-    ostringstream ostr;
-    ostr << "frames: " << all_corners.size();
-    cv::putText(frame, ostr.str(), cv::Point(5, 15), CV_FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255,0,255), 1.5, CV_AA);
-    
-    if (!frame.empty()) cv::imshow("input", frame);
   }
-  return 0;
-}
 
+  if (!is_camera) {
+    while (pool.pop(d, true)) process(d);
+  }
 
+  if (all_corners.size() < MIN_CALIBRATION_VIEWS) { cout << "not enough views for calibration: " << all_corners.size() << endl; return 1; }
 
+  /* final calibration on all views, starting from the last incremental one */
+  if (pending.valid()) current = pending.get();
+  current = calibrate(all_corners, grid3d, image_size, current, FINAL_ITERATIONS);
+  cout << "K: " << current.K << endl;
+  cout << "dist: " << current.dist_coeff << endl;
+  cout << "reprojection error: " << current.error << endl;
 
+  cv::FileStorage file("calibration.xml", cv::FileStorage::WRITE);
+  file << "K" << current.K;
+  file << "dist" << current.dist_coeff;
+  return 0;
+}
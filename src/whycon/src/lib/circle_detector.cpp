@@ -1,12 +1,13 @@
 #include <cstdio>
+#include <stdexcept>
 #include <whycon/circle_detector.h>
 using namespace std;
 
 #define min(a,b) ((a) < (b) ? (a) : (b))
 #define max(a,b) ((a) > (b) ? (a) : (b))
 
-#define ENABLE_RANDOMIZED_THRESHOLD
 #define MAX_SEGMENTS 10000 // TODO: necessary?
+#define MIN_THRESHOLD_STEP (3 * 8)
 
 whycon::CircleDetector::CircleDetector(int _width, int _height, Context* _context, const DetectorParameters& _parameters) :
 	parameters(_parameters), context(_context)
@@ -25,9 +26,19 @@ whycon::CircleDetector::CircleDetector(int _width, int _height, Context* _contex
 
   threshold = (3 * 256) / 2;
   threshold_counter = 0;
+  threshold_tracking = false;
+  last_inner_mean = last_outer_mean = 0;
+  lost_counter = 0;
 
   use_local_window = false;
   local_window_multiplier = 2.5;
+
+  if (parameters.id_bits > MAX_ID_BITS) throw std::runtime_error("Too many ID bits");
+  int samples = parameters.id_bits * ID_SAMPLES_PER_BIT;
+  for (int i = 0; i < samples; i++) {
+    id_cos.push_back(lround(cos(2 * M_PI * i / samples) * (1 << ID_FIXED_POINT_BITS)));
+    id_sin.push_back(lround(sin(2 * M_PI * i / samples) * (1 << ID_FIXED_POINT_BITS)));
+  }
 }
 
 whycon::CircleDetector::~CircleDetector()
@@ -39,8 +50,80 @@ int whycon::CircleDetector::get_threshold(void) const
   return threshold;
 }
 
+/* Samples the ellipse of the detected circle at id_sampling_ratio of the inner radius, with the same parametrization
+ * as Circle::draw. The bit phase is the one where samples agree most with the majority of their bit, and the ID is the
+ * smallest rotation of the bit pattern, since the starting angle is not known. Returns -1 if the pattern is unclear. */
+int whycon::CircleDetector::decode_id(const cv::Mat& image, const Circle& circle)
+{
+  int bits = parameters.id_bits;
+  int samples = bits * ID_SAMPLES_PER_BIT;
+
+  /* center and axes (m0, m1 are half the outer radius) in 24.8 fixed point */
+  float radius = 2 * parameters.id_sampling_ratio * diameter_ratio;
+  int cx = lround(circle.x * 256);
+  int cy = lround(circle.y * 256);
+  int ax = lround(circle.v0 * circle.m0 * radius * 256);
+  int ay = lround(circle.v1 * circle.m0 * radius * 256);
+  int bx = lround(circle.v1 * circle.m1 * radius * 256);
+  int by = lround(-circle.v0 * circle.m1 * radius * 256);
+
+  bool black[MAX_ID_BITS * ID_SAMPLES_PER_BIT];
+  for (int i = 0; i < samples; i++) {
+    int x = (cx + ((id_cos[i] * ax + id_sin[i] * bx) >> ID_FIXED_POINT_BITS) + 128) >> 8;
+    int y = (cy + ((id_cos[i] * ay + id_sin[i] * by) >> ID_FIXED_POINT_BITS) + 128) >> 8;
+    if (x < 0 || x >= width || y < 0 || y >= height) return -1;
+    black[i] = (threshold_pixel(&image.data[(y * width + x) * 3]) == BLACK);
+  }
+
+  int best_phase = 0, best_agreement = -1;
+  for (int phase = 0; phase < ID_SAMPLES_PER_BIT; phase++) {
+    int agreement = 0;
+    for (int b = 0; b < bits; b++) {
+      int count = 0;
+      for (int k = 0; k < ID_SAMPLES_PER_BIT; k++) count += black[(b * ID_SAMPLES_PER_BIT + phase + k) % samples];
+      agreement += max(count, ID_SAMPLES_PER_BIT - count);
+    }
+    if (agreement > best_agreement) { best_agreement = agreement; best_phase = phase; }
+  }
+  if (best_agreement < samples * 3 / 4) return -1;
+
+  int code = 0;
+  for (int b = 0; b < bits; b++) {
+    int count = 0;
+    for (int k = 0; k < ID_SAMPLES_PER_BIT; k++) count += black[(b * ID_SAMPLES_PER_BIT + best_phase + k) % samples];
+    code |= (2 * count > ID_SAMPLES_PER_BIT) << b;
+  }
+
+  int id = code, mask = (1 << bits) - 1;
+  for (int r = 1; r < bits; r++) {
+    code = ((code >> 1) | (code << (bits - 1))) & mask;
+    id = min(id, code);
+  }
+  return id;
+}
+
 void whycon::CircleDetector::change_threshold(void)
 {
+  /* a lost target is first searched for around its last threshold, alternating below and above it in steps of a
+   * quarter of its last contrast, the global search is only used once the whole range was tried */
+  if (threshold_tracking) {
+    int center = (last_inner_mean + last_outer_mean) / 2;
+    int step = max((last_inner_mean - last_outer_mean) / 4, MIN_THRESHOLD_STEP);
+    while (true) {
+      lost_counter++;
+      int k = (lost_counter + 1) / 2;
+      if (k * step > 3 * 255) break;
+      int candidate = center + (lost_counter % 2 ? -k : k) * step;
+      if (candidate > 0 && candidate < 3 * 255) {
+        threshold = candidate;
+        WHYCON_DEBUG("threshold changed to " << threshold << " (local search)");
+        return;
+      }
+    }
+    threshold_tracking = false;
+    threshold_counter = 0;
+  }
+
   //int old_threshold = threshold;
   #if !defined(ENABLE_RANDOMIZED_THRESHOLD)
   threshold_counter++;
@@ -91,19 +174,39 @@ bool whycon::CircleDetector::examineCircle(const cv::Mat& image, whycon::CircleD
 	miny = maxy = circle.y;
 	circle.valid = false;
 	circle.round = false;
+
+  /* a valid segment has at most max_size pixels and, being round, a bounding box of at most (1 + roundness_tolerance)
+   * times its size / areaRatio, so the fill is aborted as soon as either is exceeded or the box outgrows the expected
+   * marker size: max_apparent_diameter or, while the target is tracked, the local window around its previous detection */
+  float max_box_area = (1 + parameters.roundness_tolerance) * parameters.max_size / areaRatio;
+
+  int window_minx = 0, window_maxx = width, window_miny = 0, window_maxy = height;
+  if (search_in_window) {
+    window_minx = local_window_x; window_maxx = local_window_x + local_window_width;
+    window_miny = local_window_y; window_maxy = local_window_y + local_window_height;
+  }
+
 	//push segment coords to the queue
 	queue[queueEnd++] = ii;
 	//and until queue is empty
 	while (queueEnd > queueStart){
+    if (queueEnd - queueOldStart > parameters.max_size ||
+        (float)(maxx - minx + 1) * (maxy - miny + 1) > max_box_area ||
+        maxx - minx >= expected_max_width || maxy - miny >= expected_max_height)
+    {
+      circle.size = queueEnd - queueOldStart;
+      WHYCON_DEBUG("segment too large, aborted at " << circle.size << " pixels with size " << maxx - minx + 1 << " x " << maxy - miny + 1);
+      return false;
+    }
+
 		//pull the coord from the queue
 		position = queue[queueStart++];
-		//search neighbours
 
-    int position_x = position % width;
+    /* no image bounds checks are needed, pixels on the image border are marked as Context::BORDER and never queued */
     int position_y = position / width;
+    int position_x = position - position_y * width;
 
-    if ((search_in_window && position_x + 1 < min(local_window_x + local_window_width, width)) ||
-        (!search_in_window && position_x + 1 < width))
+    if (!search_in_window || position_x + 1 < window_maxx)
     {
       pos = position + 1;
       pixel_class = buffer[pos];
@@ -114,13 +217,12 @@ bool whycon::CircleDetector::examineCircle(const cv::Mat& image, whycon::CircleD
       }
       if (pixel_class == type) {
         queue[queueEnd++] = pos;
-        maxx = max(maxx,pos%width);
+        maxx = max(maxx,position_x + 1);
         buffer[pos] = segment_id;
       }
     }
     
-    if ((search_in_window && position_x - 1 >= local_window_x) ||
-        (!search_in_window && position_x - 1 >= 0))
+    if (!search_in_window || position_x - 1 >= window_minx)
     {
       pos = position-1;
       pixel_class = buffer[pos];
@@ -131,13 +233,12 @@ bool whycon::CircleDetector::examineCircle(const cv::Mat& image, whycon::CircleD
       }
       if (pixel_class == type) {
         queue[queueEnd++] = pos;
-        minx = min(minx,pos%width);
+        minx = min(minx,position_x - 1);
         buffer[pos] = segment_id;
       }
     }
 
-    if ((search_in_window && position_y - 1 >= local_window_y) ||
-        (!search_in_window && position_y - 1 >= 0))
+    if (!search_in_window || position_y - 1 >= window_miny)
     {
       pos = position-width;
       pixel_class = buffer[pos];
@@ -148,13 +249,12 @@ bool whycon::CircleDetector::examineCircle(const cv::Mat& image, whycon::CircleD
       }
       if (pixel_class == type) {
         queue[queueEnd++] = pos;
-        miny = min(miny,pos/width);
+        miny = min(miny,position_y - 1);
         buffer[pos] = segment_id;
       }
     }
 
-		if ((search_in_window && position_y + 1 < min(local_window_y + local_window_height, height)) ||
-				(!search_in_window && position_y + 1 < height))
+		if (!search_in_window || position_y + 1 < window_maxy)
 		{
 			pos = position+width;
 			pixel_class = buffer[pos];
@@ -165,12 +265,10 @@ bool whycon::CircleDetector::examineCircle(const cv::Mat& image, whycon::CircleD
 			}
 			if (pixel_class == type) {
 				queue[queueEnd++] = pos;
-				maxy = max(maxy,pos/width);
+				maxy = max(maxy,position_y + 1);
 				buffer[pos] = segment_id;
 			}
 		}
-
-    //if (queueEnd-queueOldStart > maxSize) return false;
   }
 
 	//once the queue is empty, i.e. segment is complete, we compute its size 
@@ -251,7 +349,19 @@ whycon::CircleDetector::Circle whycon::CircleDetector::detect(const cv::Mat& ima
 
 	bool search_in_window = false;
 	int local_x, local_y;
+  expected_max_width = width;
+  expected_max_height = height;
+  if (parameters.max_apparent_diameter > 0) {
+    expected_max_width = min(width, parameters.max_apparent_diameter);
+    expected_max_height = min(height, parameters.max_apparent_diameter);
+  }
 	if (previous_circle.valid){
+    /* while tracked, the marker cannot grow beyond the local window size between calls */
+    if (threshold_tracking && lost_counter == 0) {
+      expected_max_width = local_window_multiplier * (previous_circle.maxx - previous_circle.minx + 1);
+      expected_max_height = local_window_multiplier * (previous_circle.maxy - previous_circle.miny + 1);
+    }
+
 		WHYCON_DEBUG("starting with previously valid circle at " << previous_circle.x << "," << previous_circle.y);
 		ii = ((int)previous_circle.y)*width+(int)previous_circle.x;
 		start = ii;
@@ -383,6 +493,8 @@ whycon::CircleDetector::Circle whycon::CircleDetector::detect(const cv::Mat& ima
 								outer.valid = inner.valid = true; // at this point, the target is considered valid
                 /*inner_id = numSegments; outer_id = numSegments - 1;*/
                 threshold = (outer.mean + inner.mean) / 2; // use a new threshold estimate based on current detection
+                last_inner_mean = inner.mean;
+                last_outer_mean = outer.mean;
                 //cout << "threshold set to average: " << threshold << endl;
 
 #if 1
@@ -408,6 +520,7 @@ whycon::CircleDetector::Circle whycon::CircleDetector::detect(const cv::Mat& ima
                 inner.maxx = outer.maxx;
                 inner.maxy = outer.maxy;
                 inner.miny = outer.miny;
+                if (parameters.id_bits > 0) inner.id = decode_id(image, inner);
 
                 WHYCON_DEBUG("found inner segment " << context->total_segments - 1);
                 break;
@@ -431,8 +544,11 @@ whycon::CircleDetector::Circle whycon::CircleDetector::detect(const cv::Mat& ima
 	} while (ii != start);
 
 	// draw
-	if (inner.valid)
+	if (inner.valid) {
 		threshold_counter = 0;
+    threshold_tracking = true;
+    lost_counter = 0;
+  }
   else
     change_threshold(); // update threshold for next run. inner is what user receives
 
@@ -470,6 +586,7 @@ whycon::CircleDetector::Circle::Circle(void)
 {
   x = y = 0;
   round = valid = false;
+  id = -1;
 }
 
 void whycon::CircleDetector::Circle::draw(cv::Mat& image, const std::string& text, cv::Vec3b color, float thickness) const
@@ -495,7 +612,7 @@ void whycon::CircleDetector::Circle::write(cv::FileStorage& fs) const {
   fs << "{" << "x" << x << "y" << y << "size" << size <<
     "maxy" << maxy << "maxx" << maxx << "miny" << miny << "minx" << minx <<
     "mean" << mean << "type" << type << "roundness" << roundness << "bwRatio" << bwRatio <<
-    "round" << round << "valid" << valid << "m0" << m0 << "m1" << m1 << "v0" << v0 << "v1" << v1 << "}";
+    "round" << round << "valid" << valid << "m0" << m0 << "m1" << m1 << "v0" << v0 << "v1" << v1 << "id" << id << "}";
 }
 
 void whycon::CircleDetector::Circle::read(const cv::FileNode& node)
@@ -517,6 +634,7 @@ void whycon::CircleDetector::Circle::read(const cv::FileNode& node)
   m1 = (float)node["m1"];
   v0 = (float)node["v0"];
   v1 = (float)node["v1"];
+  id = node["id"].empty() ? -1 : (int)node["id"];
 }
 
 whycon::CircleDetector::Context::Context(int _width, int _height)
@@ -542,6 +660,13 @@ void whycon::CircleDetector::Context::cleanup_buffer(void)
 {
 	WHYCON_DEBUG("clean whole buffer");
 	memset(&buffer[0], -1, sizeof(int)*buffer.size());
+	mark_border();
+}
+
+void whycon::CircleDetector::Context::mark_border(void)
+{
+  for (int x = 0; x < width; x++) buffer[x] = buffer[(height - 1) * width + x] = BORDER;
+  for (int y = 0; y < height; y++) buffer[y * width] = buffer[y * width + width - 1] = BORDER;
 }
 
 void whycon::CircleDetector::Context::cleanup_buffer(const Circle& c) {
@@ -12,9 +12,23 @@ using std::cout;
 using std::endl;
 using std::numeric_limits;
 
+/* the parameters with max_apparent_diameter set from min_distance: a marker seen off-axis or through the lens distortion
+ * appears somewhat larger than f * outer_diameter / min_distance, hence the margin */
+static whycon::DetectorParameters bound_apparent_diameter(const whycon::DetectorParameters& parameters, const cv::Mat& K)
+{
+  const double APPARENT_DIAMETER_MARGIN = 1.25;
+
+  whycon::DetectorParameters bounded = parameters;
+  if (parameters.min_distance > 0) {
+    double focal_length = std::max(K.at<double>(0,0), K.at<double>(1,1));
+    bounded.max_apparent_diameter = ceil(APPARENT_DIAMETER_MARGIN * focal_length * parameters.outer_diameter / parameters.min_distance);
+  }
+  return bounded;
+}
+
 whycon::LocalizationSystem::LocalizationSystem(int _targets, int _width, int _height, const cv::Mat& _K, const cv::Mat& _dist_coeff,
 																							 const whycon::DetectorParameters& parameters) :
-  detector(_targets, _width, _height, parameters),
+  detector(_targets, _width, _height, bound_apparent_diameter(parameters, _K)),
   targets(_targets), width(_width), height(_height), circle_diameter(parameters.outer_diameter)
 {
   _K.copyTo(K);
@@ -25,8 +39,13 @@ whycon::LocalizationSystem::LocalizationSystem(int _targets, int _width, int _he
   cc[0] = K.at<double>(0,2);
   cc[1] = K.at<double>(1,2);
   
+  int coefficients = dist_coeff.total();
+  if (coefficients != 0 && coefficients != 4 && coefficients != 5 && coefficients != 8 && coefficients != 12 && coefficients != 14)
+    throw std::runtime_error("unsupported number of distortion coefficients");
+
   kc[0] = 1;
-  for (int i = 0; i < 5; i++) kc[i + 1] = dist_coeff.at<double>(i);
+  for (int i = 0; i < 12; i++) kc[i + 1] = (i < coefficients ? dist_coeff.at<double>(i) : 0);
+  tilted = (coefficients == 14 && (dist_coeff.at<double>(12) != 0 || dist_coeff.at<double>(13) != 0));
 
   precompute_undistort_map();
 
@@ -37,12 +56,122 @@ bool whycon::LocalizationSystem::localize(const cv::Mat& image, bool reset, int
   return detector.detect(image, reset, attempts, max_refine);
 }
 
-whycon::LocalizationSystem::Pose whycon::LocalizationSystem::get_pose(const whycon::CircleDetector::Circle& circle) const {
+whycon::LocalizationSystem::Pose whycon::LocalizationSystem::get_pose(const whycon::CircleDetector::Circle& circle, const cv::Vec3d& row_rotation) const {
+  #if defined(ENABLE_FLOAT_POSE)
+  return compute_pose<float>(circle, row_rotation);
+  #else
+  return compute_pose<double>(circle, row_rotation);
+  #endif
+}
+
+/* moves a normalized point, read the given number of rows after the ellipse center, to where it would have been seen
+ * when the center row was read, for small rotations: d' = d + (rows * row_rotation) x d with d = (x, y, 1) */
+template <typename T>
+static void compensate_rotation(T& x, T& y, T rows, const cv::Vec3d& row_rotation)
+{
+  T wx = row_rotation(0) * rows, wy = row_rotation(1) * rows, wz = row_rotation(2) * rows;
+  T dx = x + wy - wz * y;
+  T dy = y + wz * x - wx;
+  T dz = 1 + wx * y - wy * x;
+  x = dx / dz;
+  y = dy / dz;
+}
+
+/* largest off-diagonal element in row k right of the diagonal and in column k above it */
+template <typename T>
+static int max_in_row(const T A[3][3], int k)
+{
+  int m = k + 1;
+  for (int i = k + 2; i < 3; i++) if (fabs(A[k][m]) < fabs(A[k][i])) m = i;
+  return m;
+}
+
+template <typename T>
+static int max_in_column(const T A[3][3], int k)
+{
+  int m = 0;
+  for (int i = 1; i < k; i++) if (fabs(A[m][k]) < fabs(A[i][k])) m = i;
+  return m;
+}
+
+/* Jacobi eigenvalue algorithm for symmetric 3x3 matrices on the upper triangle of A, with the same pivoting, rotations
+ * and sorting as cv::eigen (hal::Jacobi). Eigenvalues are sorted in descending order and the eigenvectors are stored as
+ * rows. Their signs select one of the two pose solutions, so they have to match the ones of cv::eigen and not only
+ * the eigenvectors themselves; pose-accuracy-check verifies this against the OpenCV in use (cv::eigen differs if
+ * OpenCV was built with Eigen) */
+template <typename T>
+static void symmetric_eigen(T A[3][3], T eigenvalues[3], T eigenvectors[3][3])
+{
+  T* W = eigenvalues;
+  T (*V)[3] = eigenvectors;
+  int row_max[3], column_max[3];
+
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) V[i][j] = (i == j ? 1 : 0);
+    W[i] = A[i][i];
+    if (i < 2) row_max[i] = max_in_row(A, i);
+    if (i > 0) column_max[i] = max_in_column(A, i);
+  }
+
+  for (int iteration = 0; iteration < 3 * 3 * 30; iteration++) {
+    /* pivot (k, l) is the largest off-diagonal element */
+    int k = 0;
+    T max_value = fabs(A[0][row_max[0]]);
+    for (int i = 1; i < 2; i++) {
+      if (max_value < fabs(A[i][row_max[i]])) { max_value = fabs(A[i][row_max[i]]); k = i; }
+    }
+    int l = row_max[k];
+    for (int i = 1; i < 3; i++) {
+      if (max_value < fabs(A[column_max[i]][i])) { max_value = fabs(A[column_max[i]][i]); k = column_max[i]; l = i; }
+    }
+
+    T p = A[k][l];
+    if (fabs(p) <= numeric_limits<T>::epsilon()) break;
+
+    T y = (W[l] - W[k]) * T(0.5);
+    T t = fabs(y) + std::hypot(p, y);
+    T s = std::hypot(p, t);
+    T c = t / s;
+    s = p / s;
+    t = (p / t) * p;
+    if (y < 0) { s = -s; t = -t; }
+
+    A[k][l] = 0;
+    W[k] -= t;
+    W[l] += t;
+
+    #define ROTATE(v0, v1) { T a0 = v0, b0 = v1; v0 = a0 * c - b0 * s; v1 = a0 * s + b0 * c; }
+    for (int i = 0; i < k; i++) ROTATE(A[i][k], A[i][l]);
+    for (int i = k + 1; i < l; i++) ROTATE(A[k][i], A[i][l]);
+    for (int i = l + 1; i < 3; i++) ROTATE(A[k][i], A[l][i]);
+    for (int i = 0; i < 3; i++) ROTATE(V[k][i], V[l][i]);
+    #undef ROTATE
+
+    for (int idx : { k, l }) {
+      if (idx < 2) row_max[idx] = max_in_row(A, idx);
+      if (idx > 0) column_max[idx] = max_in_column(A, idx);
+    }
+  }
+
+  for (int k = 0; k < 2; k++) {
+    int m = k;
+    for (int i = k + 1; i < 3; i++) if (W[m] < W[i]) m = i;
+    if (k != m) {
+      std::swap(W[m], W[k]);
+      for (int i = 0; i < 3; i++) std::swap(V[m][i], V[k][i]);
+    }
+  }
+}
+
+/* computes the pose with scalar type T, everything is kept on the stack */
+template <typename T>
+whycon::LocalizationSystem::Pose whycon::LocalizationSystem::compute_pose(const whycon::CircleDetector::Circle& circle, const cv::Vec3d& row_rotation) const {
   Pose result;
-  double x,y,x1,x2,y1,y2,sx1,sx2,sy1,sy2,major,minor,v0,v1;
+  bool compensate = (row_rotation != cv::Vec3d(0, 0, 0));
+  T x,y,x1,x2,y1,y2,sx1,sx2,sy1,sy2,major,minor,v0,v1;
   
   //transform the center
-	transform(circle.x,circle.y, x, y);
+	transform<T>(circle.x,circle.y, x, y);
   
   //calculate the major axis 
 	//endpoints in image coords
@@ -52,14 +181,18 @@ whycon::LocalizationSystem::Pose whycon::LocalizationSystem::get_pose(const whyc
 	sy2 = circle.y - circle.v1 * circle.m0 * 2;
 
   //endpoints in camera coords 
-	transform(sx1, sy1, x1, y1);
-	transform(sx2, sy2, x2, y2);
+	transform<T>(sx1, sy1, x1, y1);
+	transform<T>(sx2, sy2, x2, y2);
+	if (compensate) {
+		compensate_rotation<T>(x1, y1, sy1 - circle.y, row_rotation);
+		compensate_rotation<T>(x2, y2, sy2 - circle.y, row_rotation);
+	}
 
   //semiaxis length 
-	major = sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2))/2.0;
+	major = sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2))/2;
   
-	v0 = (x2-x1)/major/2.0;
-	v1 = (y2-y1)/major/2.0;
+	v0 = (x2-x1)/major/2;
+	v1 = (y2-y1)/major/2;
 
 	//calculate the minor axis 
 	//endpoints in image coords
@@ -69,69 +202,70 @@ whycon::LocalizationSystem::Pose whycon::LocalizationSystem::get_pose(const whyc
 	sy2 = circle.y + circle.v0 * circle.m1 * 2;
   
 	//endpoints in camera coords 
-	transform(sx1, sy1, x1, y1);
-	transform(sx2, sy2, x2, y2);
+	transform<T>(sx1, sy1, x1, y1);
+	transform<T>(sx2, sy2, x2, y2);
+	if (compensate) {
+		compensate_rotation<T>(x1, y1, sy1 - circle.y, row_rotation);
+		compensate_rotation<T>(x2, y2, sy2 - circle.y, row_rotation);
+	}
 
 	//semiaxis length 
-	minor = sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2))/2.0;
+	minor = sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2))/2;
 
 	//construct the conic
-	double a,b,c,d,e,f;
+	T a,b,c,d,e,f;
 	a = v0*v0/(major*major)+v1*v1/(minor*minor);
 	b = v0*v1*(1/(major*major)-1/(minor*minor));
 	c = v0*v0/(minor*minor)+v1*v1/(major*major);
 	d = (-x*a-b*y);
 	e = (-y*c-b*x);
 	f = (a*x*x+c*y*y+2*b*x*y-1);
-	cv::Matx33d data(a,b,d,
-									 b,c,e,
-									 d,e,f);
+	T data[3][3] = { {a,b,d},
+	                 {b,c,e},
+	                 {d,e,f} };
 
 	// compute conic eigenvalues and eigenvectors
-	cv::Vec3d eigenvalues;
-	cv::Matx33d eigenvectors;
-	cv::eigen(data, eigenvalues, eigenvectors);
+	T eigenvalues[3];
+	T eigenvectors[3][3];
+	symmetric_eigen(data, eigenvalues, eigenvectors);
 
 	// compute ellipse parameters in real-world
-	double L1 = eigenvalues(1);
-	double L2 = eigenvalues(0);
-	double L3 = eigenvalues(2);
+	T L1 = eigenvalues[1];
+	T L2 = eigenvalues[0];
+	T L3 = eigenvalues[2];
 	int V2 = 0;
 	int V3 = 2;
 
 	// position
-	double z = circle_diameter/sqrt(-L2*L3)/2.0;
-	cv::Matx13d position_mat = L3 * sqrt((L2 - L1) / (L2 - L3)) * eigenvectors.row(V2) + L2 * sqrt((L1 - L3) / (L2 - L3)) * eigenvectors.row(V3);
-	result.pos = cv::Vec3f(position_mat(0), position_mat(1), position_mat(2));
+	T z = circle_diameter/sqrt(-L2*L3)/2;
+	T w2 = L3 * sqrt((L2 - L1) / (L2 - L3));
+	T w3 = L2 * sqrt((L1 - L3) / (L2 - L3));
+	for (int i = 0; i < 3; i++) result.pos(i) = w2 * eigenvectors[V2][i] + w3 * eigenvectors[V3][i];
 	int S3 = (result.pos(2) * z < 0 ? -1 : 1);
 	result.pos *= S3 * z;
 
-	/*float dist = sqrt(L1 * L1 * L1) * circle_diameter * 0.5;
-	std::cout << "d1 " << dist << " " << cv::norm(result.pos) << std::endl;*/
-
-
 	WHYCON_DEBUG("ellipse center: " << x << "," << y << " " << " computed position: " << result.pos << " " << result.pos / result.pos(2));
 
 	// rotation
-	cv::Matx13d normal_mat = sqrt((L2 - L1) / (L2 - L3)) * eigenvectors.row(V2) + sqrt((L1 - L3) / (L2 - L3)) * eigenvectors.row(V3);
-	cv::normalize(cv::Vec3f(normal_mat(0), normal_mat(1), normal_mat(2)), result.rot, 1, cv::NORM_L2SQR);
+	T n2 = sqrt((L2 - L1) / (L2 - L3));
+	T n3 = sqrt((L1 - L3) / (L2 - L3));
+	T normal[3];
+	for (int i = 0; i < 3; i++) normal[i] = n2 * eigenvectors[V2][i] + n3 * eigenvectors[V3][i];
+
+	/* same scaling as cv::normalize(normal, rot, 1, cv::NORM_L2SQR) */
+	T norm2 = normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2];
+	for (int i = 0; i < 3; i++) result.rot(i) = normal[i] / norm2;
 	result.rot(0) = atan2(result.rot(1), result.rot(0));
 	result.rot(1) = acos(result.rot(2));
 	result.rot(2) = 0; /* not recoverable */
 	/* TODO: to be checked */
 
-	/*cv::Matx33d data_inv;
-	cv::invert(data, data_inv);
-	cv::Matx31d projection = data_inv * normal_mat.t();
-	std::cout << "det " << cv::determinant(data_inv) << std::endl;
-	//cv::Vec3f new_center = cv::normalize(cv::Vec3f(projection(0), projection(1), projection(2))) * dist;
-	cv::Vec3f new_center = cv::Vec3f(projection(0) / projection(2), projection(1) / projection(2), 1) * dist;
-	std::cout << "center: " << new_center(0) << "," << new_center(1) << "," << new_center(2) << " vs " << result.pos << std::endl;
-	std::cout << "normalized: " << cv::normalize(new_center) << " " << cv::normalize(result.pos) << std::endl;*/
-
   return result;
 }
 
+template whycon::LocalizationSystem::Pose whycon::LocalizationSystem::compute_pose<float>(const whycon::CircleDetector::Circle& circle, const cv::Vec3d& row_rotation) const;
+template whycon::LocalizationSystem::Pose whycon::LocalizationSystem::compute_pose<double>(const whycon::CircleDetector::Circle& circle, const cv::Vec3d& row_rotation) const;
+
 const whycon::CircleDetector::Circle& whycon::LocalizationSystem::get_circle(int id)
 {
   return detector.circles[id];
@@ -142,17 +276,37 @@ whycon::LocalizationSystem::Pose whycon::LocalizationSystem::get_pose(int id) co
   return get_pose(detector.circles[id]);
 }
 
-/* normalize coordinates: move from image to canonical and remove distortion */
-void whycon::LocalizationSystem::transform(double x_in, double y_in, double& x_out, double& y_out) const
+/* normalize coordinates: move from image to canonical and remove distortion, iterating as cv::undistortPoints does
+ * (radial, rational and thin prism terms; the rare tilted sensor model is left to cv::undistortPoints itself) */
+template <typename T>
+void whycon::LocalizationSystem::transform(T x_in, T y_in, T& x_out, T& y_out) const
 {
-  #if defined(ENABLE_FULL_UNDISTORT)
-  x_out = (x_in-cc[0])/fc[0];
-  y_out = (y_in-cc[1])/fc[1];
-  #else
-  std::vector<cv::Vec2d> src(1, cv::Vec2d(x_in, y_in));
-  std::vector<cv::Vec2d> dst(1);
-  cv::undistortPoints(src, dst, K, dist_coeff);
-  x_out = dst[0](0); y_out = dst[0](1);
+  #if !defined(ENABLE_FULL_UNDISTORT)
+  if (tilted) {
+    double src[2] = { x_in, y_in }, dst[2];
+    cv::Mat src_mat(1, 1, CV_64FC2, src), dst_mat(1, 1, CV_64FC2, dst);
+    cv::undistortPoints(src_mat, dst_mat, K, dist_coeff);
+    x_out = dst[0];
+    y_out = dst[1];
+    return;
+  }
+  #endif
+
+  x_out = (x_in - T(cc[0])) / T(fc[0]);
+  y_out = (y_in - T(cc[1])) / T(fc[1]);
+
+  #if !defined(ENABLE_FULL_UNDISTORT)
+  T k1 = kc[1], k2 = kc[2], p1 = kc[3], p2 = kc[4], k3 = kc[5], k4 = kc[6], k5 = kc[7], k6 = kc[8];
+  T s1 = kc[9], s2 = kc[10], s3 = kc[11], s4 = kc[12];
+  T x0 = x_out, y0 = y_out;
+  for (int i = 0; i < UNDISTORT_ITERATIONS; i++) {
+    T r2 = x_out * x_out + y_out * y_out;
+    T icdist = (1 + ((k6 * r2 + k5) * r2 + k4) * r2) / (1 + ((k3 * r2 + k2) * r2 + k1) * r2);
+    T delta_x = 2 * p1 * x_out * y_out + p2 * (r2 + 2 * x_out * x_out) + s1 * r2 + s2 * r2 * r2;
+    T delta_y = p1 * (r2 + 2 * y_out * y_out) + 2 * p2 * x_out * y_out + s3 * r2 + s4 * r2 * r2;
+    x_out = (x0 - delta_x) * icdist;
+    y_out = (y0 - delta_y) * icdist;
+  }
   #endif
 }
 
@@ -0,0 +1,198 @@
+/* Compares LocalizationSystem::compute_pose<float> and compute_pose<double> against the original pose computation,
+ * which used cv::undistortPoints and cv::eigen, on synthetic ellipses: projections of randomly placed and oriented
+ * circles through a distorting camera, described by their moments as the detector does. The eigenvector signs select
+ * one of the two pose solutions, so this also fails if the eigen decomposition does not reproduce the ones of the
+ * cv::eigen in use. Cameras with 5, 8, 12 and 14 distortion coefficients are checked. Returns non-zero if an error is
+ * above the tolerance.
+ *
+ * usage: pose-accuracy-check [samples] [seed] */
+
+#include <opencv2/opencv.hpp>
+#include <whycon/localization_system.h>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+using namespace std;
+
+const int WIDTH = 640, HEIGHT = 480;
+const int BOUNDARY_POINTS = 2000;
+const float MIN_MINOR_AXIS = 3; // pixels, smaller ellipses are not detected
+
+/* relative position error w.r.t. the reference, single precision loses most digits in the conic of small, far ellipses */
+const double DOUBLE_TOLERANCE = 1e-6;
+const double FLOAT_TOLERANCE = 2e-3;
+
+mt19937 rng;
+
+double uniform(double min, double max) {
+  return uniform_real_distribution<double>(min, max)(rng);
+}
+
+/* the original get_pose(), before compute_pose<T> */
+cv::Vec3f reference_position(const whycon::CircleDetector::Circle& circle, const cv::Mat& K, const cv::Mat& dist_coeff, double circle_diameter)
+{
+  auto transform = [&](double x_in, double y_in, double& x_out, double& y_out) {
+    #if defined(ENABLE_FULL_UNDISTORT)
+    x_out = (x_in - K.at<double>(0, 2)) / K.at<double>(0, 0);
+    y_out = (y_in - K.at<double>(1, 2)) / K.at<double>(1, 1);
+    #else
+    std::vector<cv::Vec2d> src(1, cv::Vec2d(x_in, y_in));
+    std::vector<cv::Vec2d> dst(1);
+    cv::undistortPoints(src, dst, K, dist_coeff);
+    x_out = dst[0](0); y_out = dst[0](1);
+    #endif
+  };
+
+  double x,y,x1,x2,y1,y2,sx1,sx2,sy1,sy2,major,minor,v0,v1;
+  transform(circle.x, circle.y, x, y);
+
+  sx1 = circle.x + circle.v0 * circle.m0 * 2;
+  sx2 = circle.x - circle.v0 * circle.m0 * 2;
+  sy1 = circle.y + circle.v1 * circle.m0 * 2;
+  sy2 = circle.y - circle.v1 * circle.m0 * 2;
+  transform(sx1, sy1, x1, y1);
+  transform(sx2, sy2, x2, y2);
+  major = sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2))/2.0;
+  v0 = (x2-x1)/major/2.0;
+  v1 = (y2-y1)/major/2.0;
+
+  sx1 = circle.x + circle.v1 * circle.m1 * 2;
+  sx2 = circle.x - circle.v1 * circle.m1 * 2;
+  sy1 = circle.y - circle.v0 * circle.m1 * 2;
+  sy2 = circle.y + circle.v0 * circle.m1 * 2;
+  transform(sx1, sy1, x1, y1);
+  transform(sx2, sy2, x2, y2);
+  minor = sqrt((x1-x2)*(x1-x2)+(y1-y2)*(y1-y2))/2.0;
+
+  double a,b,c,d,e,f;
+  a = v0*v0/(major*major)+v1*v1/(minor*minor);
+  b = v0*v1*(1/(major*major)-1/(minor*minor));
+  c = v0*v0/(minor*minor)+v1*v1/(major*major);
+  d = (-x*a-b*y);
+  e = (-y*c-b*x);
+  f = (a*x*x+c*y*y+2*b*x*y-1);
+  cv::Matx33d data(a,b,d,
+                   b,c,e,
+                   d,e,f);
+
+  cv::Vec3d eigenvalues;
+  cv::Matx33d eigenvectors;
+  cv::eigen(data, eigenvalues, eigenvectors);
+
+  double L1 = eigenvalues(1);
+  double L2 = eigenvalues(0);
+  double L3 = eigenvalues(2);
+  int V2 = 0;
+  int V3 = 2;
+
+  double z = circle_diameter/sqrt(-L2*L3)/2.0;
+  cv::Matx13d position_mat = L3 * sqrt((L2 - L1) / (L2 - L3)) * eigenvectors.row(V2) + L2 * sqrt((L1 - L3) / (L2 - L3)) * eigenvectors.row(V3);
+  cv::Vec3f pos(position_mat(0), position_mat(1), position_mat(2));
+  int S3 = (pos(2) * z < 0 ? -1 : 1);
+  pos *= S3 * z;
+  return pos;
+}
+
+/* ellipse of a circle with the given center and normal as seen by the detector: centroid, axis directions and the square
+ * roots of the covariance eigenvalues (half the semiaxes) of the projected disc. Returns false if it is not
+ * fully visible or too thin to be detected */
+bool project_circle(const cv::Vec3d& center, const cv::Vec3d& normal, double diameter, const cv::Mat& K, const cv::Mat& dist_coeff,
+                    whycon::CircleDetector::Circle& circle)
+{
+  cv::Vec3d n = cv::normalize(normal);
+  cv::Vec3d u = n.cross(fabs(n(0)) < 0.9 ? cv::Vec3d(1, 0, 0) : cv::Vec3d(0, 1, 0));
+  u = cv::normalize(u);
+  cv::Vec3d v = n.cross(u);
+
+  vector<cv::Point3d> boundary(BOUNDARY_POINTS);
+  for (int i = 0; i < BOUNDARY_POINTS; i++) {
+    double angle = 2 * M_PI * i / BOUNDARY_POINTS;
+    cv::Vec3d p = center + diameter / 2 * (cos(angle) * u + sin(angle) * v);
+    boundary[i] = cv::Point3d(p(0), p(1), p(2));
+  }
+
+  vector<cv::Point2d> projected;
+  cv::projectPoints(boundary, cv::Vec3d(0, 0, 0), cv::Vec3d(0, 0, 0), K, dist_coeff, projected);
+  for (const cv::Point2d& p : projected)
+    if (p.x < 0 || p.y < 0 || p.x >= WIDTH || p.y >= HEIGHT) return false;
+
+  /* polygon moments, cv::moments only takes integer or float contours */
+  cv::Moments m = cv::moments(vector<cv::Point2f>(projected.begin(), projected.end()));
+  double cxx = m.mu20 / m.m00, cxy = m.mu11 / m.m00, cyy = m.mu02 / m.m00;
+
+  /* eigen decomposition of the 2x2 covariance, (v0,v1) along the larger eigenvalue */
+  double mean = (cxx + cyy) / 2, radius = sqrt((cxx - cyy) * (cxx - cyy) / 4 + cxy * cxy);
+  double angle = 0.5 * atan2(2 * cxy, cxx - cyy);
+
+  circle.x = m.m10 / m.m00;
+  circle.y = m.m01 / m.m00;
+  circle.m0 = sqrt(mean + radius);
+  circle.m1 = sqrt(max(mean - radius, 0.0));
+  circle.v0 = cos(angle);
+  circle.v1 = sin(angle);
+
+  return circle.m1 * 2 >= MIN_MINOR_AXIS;
+}
+
+/* compares the poses of the given camera, returns the number of failed samples */
+int check_camera(const cv::Mat& K, const cv::Mat& dist_coeff, int samples)
+{
+  whycon::DetectorParameters parameters;
+  whycon::LocalizationSystem system(1, WIDTH, HEIGHT, K, dist_coeff, parameters);
+
+  double max_error_double = 0, max_error_float = 0, sum_error_float = 0;
+  int tested = 0, failed_double = 0, failed_float = 0;
+
+  while (tested < samples) {
+    cv::Vec3d center(uniform(-1, 1), uniform(-0.8, 0.8), uniform(0.3, 4));
+    cv::Vec3d normal(uniform(-1, 1), uniform(-1, 1), -1);
+
+    whycon::CircleDetector::Circle circle;
+    if (!project_circle(center, normal, parameters.outer_diameter, K, dist_coeff, circle)) continue;
+    tested++;
+
+    cv::Vec3f reference = reference_position(circle, K, dist_coeff, parameters.outer_diameter);
+    cv::Vec3f pos_double = system.compute_pose<double>(circle).pos;
+    cv::Vec3f pos_float = system.compute_pose<float>(circle).pos;
+
+    double error_double = cv::norm(pos_double - reference) / cv::norm(reference);
+    double error_float = cv::norm(pos_float - reference) / cv::norm(reference);
+
+    if (error_double > DOUBLE_TOLERANCE) {
+      if (failed_double++ < 10) cout << "double: " << pos_double << " instead of " << reference << " for circle at " << center << endl;
+    }
+    if (error_float > FLOAT_TOLERANCE) {
+      if (failed_float++ < 10) cout << "float: " << pos_float << " instead of " << reference << " for circle at " << center << endl;
+    }
+
+    max_error_double = max(max_error_double, error_double);
+    max_error_float = max(max_error_float, error_float);
+    sum_error_float += error_float;
+  }
+
+  cout << dist_coeff.total() << " distortion coefficients, " << tested << " ellipses, relative position error w.r.t. cv::undistortPoints/cv::eigen:" << endl;
+  cout << "double: max " << max_error_double << ", " << failed_double << " above " << DOUBLE_TOLERANCE << endl;
+  cout << "float:  max " << max_error_float << ", mean " << sum_error_float / tested << ", " << failed_float << " above " << FLOAT_TOLERANCE << endl;
+
+  return failed_double + failed_float;
+}
+
+int main(int argc, char** argv)
+{
+  int samples = (argc > 1 ? atoi(argv[1]) : 10000);
+  rng.seed(argc > 2 ? atoi(argv[2]) : 0);
+
+  /* close to the Intel Aero camera, with noticeable distortion */
+  cv::Mat K = (cv::Mat_<double>(3, 3) << 627, 0, 320, 0, 627, 240, 0, 0, 1);
+
+  /* plumb bob, then with rational, thin prism and tilt terms as supported by cv::undistortPoints */
+  double coefficients[14] = { 0.05, -0.1, 0.001, 0.002, 0.02, 0.01, -0.02, 0.03, 0.001, -0.0005, 0.0008, 0.0003, 0.002, -0.001 };
+  int failed = 0;
+  for (int n : { 5, 8, 12, 14 }) {
+    cv::Mat dist_coeff = cv::Mat(1, n, CV_64F, coefficients).clone();
+    failed += check_camera(K, dist_coeff, samples);
+  }
+
+  return (failed == 0 ? 0 : 1);
+}
@@ -0,0 +1,40 @@
+#include <whycon/config.h>
+
+#if defined(ENABLE_ALLOCATION_COUNTER)
+#include <cstdlib>
+#include <new>
+#include "allocation_counter.h"
+
+/* replaces the global allocation functions, only the allocations of the calling thread are reported. This only works
+ * when linked into an executable: a library loaded by the nodelet manager resolves operator new to libstdc++, which is
+ * already loaded, so this is not linked into whycon_nodelet */
+static thread_local size_t allocations = 0;
+
+size_t whycon::allocation_count(void)
+{
+  return allocations;
+}
+
+void* operator new(std::size_t size)
+{
+  allocations++;
+  void* ptr = std::malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+#endif
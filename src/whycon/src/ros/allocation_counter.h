@@ -0,0 +1,12 @@
+#ifndef __ALLOCATION_COUNTER_H__
+#define __ALLOCATION_COUNTER_H__
+
+#include <cstddef>
+
+namespace whycon {
+  /* number of heap allocations done so far by the calling thread, only counted with ENABLE_ALLOCATION_COUNTER in the
+   * whycon node (COUNT_ALLOCATIONS) */
+  size_t allocation_count(void);
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include "robot_pose_publisher.h"
 #include <geometry_msgs/Pose.h>
-#include <angles/angles.h>
+#include <opencv2/core/core.hpp>
+#include <limits>
+#include <stdexcept>
 
 whycon::RobotPosePublisher::RobotPosePublisher(ros::NodeHandle& n)
 {
@@ -8,58 +10,175 @@ whycon::RobotPosePublisher::RobotPosePublisher(ros::NodeHandle& n)
   n.param("world_frame", world_frame, std::string("world"));
   n.param("target_frame", target_frame, std::string("target"));
 
+  /* the layout is given as a flat list of x,y,z triples in the robot frame, by default an L-shaped pattern
+   * with the corner at the origin and two legs of axis_length, defining the forward and left axis of the robot */
+  std::vector<double> layout_param;
+  if (n.getParam("layout", layout_param)) {
+    if (layout_param.size() < 9 || layout_param.size() % 3 != 0) throw std::runtime_error("The layout needs at least three circles given as x,y,z triples");
+    for (size_t i = 0; i < layout_param.size(); i += 3)
+      layout.push_back(tf::Point(layout_param[i], layout_param[i + 1], layout_param[i + 2]));
+  }
+  else {
+    double axis_length;
+    n.param("axis_length", axis_length, 0.2);
+    layout.push_back(tf::Point(0, 0, 0));
+    layout.push_back(tf::Point(axis_length, 0, 0));
+    layout.push_back(tf::Point(0, axis_length, 0));
+  }
+
+  layout_dists.assign(layout.size(), std::vector<double>(layout.size()));
+  for (size_t a = 0; a < layout.size(); a++)
+    for (size_t b = 0; b < layout.size(); b++)
+      layout_dists[a][b] = layout[a].distance(layout[b]);
+
   broadcaster = boost::make_shared<tf::TransformBroadcaster>();
 
   pose_sub = n.subscribe<geometry_msgs::PoseArray>("/whycon/trans_poses", 1, &whycon::RobotPosePublisher::on_poses, this);
 }
 
-/* this assumes an L-shaped pattern, defining the two axis of the robot on the plane (forward and left are positive) */
 void whycon::RobotPosePublisher::on_poses(const geometry_msgs::PoseArrayConstPtr& pose_array)
 {
-  ROS_INFO_STREAM("receiving poses");
-  tf::Transform T;
-
-  if (pose_array->poses.size() != 3) { ROS_WARN_STREAM("More/less than three circles detected, will not compute pose"); return; }
-
   const std::vector<geometry_msgs::Pose>& ps = pose_array->poses;
-  float dists[3];
-  ROS_INFO_STREAM("poses: " << ps[0].position << " " << ps[1].position << " " << ps[2].position);
-
-  dists[0] = sqrt(pow(ps[0].position.x - ps[1].position.x, 2) + pow(ps[0].position.y - ps[1].position.y, 2)); // d(0,1)
-  dists[1] = sqrt(pow(ps[1].position.x - ps[2].position.x, 2) + pow(ps[1].position.y - ps[2].position.y, 2)); // d(1,2)
-  dists[2] = sqrt(pow(ps[2].position.x - ps[0].position.x, 2) + pow(ps[2].position.y - ps[0].position.y, 2)); // d(2,0)
-  ROS_INFO_STREAM("distances: " << dists[0] << " " << dists[1] << " " << dists[2]);
-  size_t max_idx = (std::max_element(dists, dists + 3) - dists);
-  std::swap(dists[max_idx], dists[0]); // dists[0] is now the longer distance (hypothenuse)
-
-
-  /* the two smaller distances correspond to the two cathetus, which should be equal in length (up to a certain tolerance) */
-  if (fabsf(dists[1] - dists[2]) > axis_length_tolerance) { ROS_WARN_STREAM("Axis size differ: " << dists[1] << " , " << dists[2]); return ; }
-  if (fabsf(dists[0] - sqrt(pow(dists[1],2) + pow(dists[2],2))) > axis_length_tolerance) { ROS_WARN_STREAM("Pythagoras check not passed"); return ; }
-
-  /* compute robot position as center of coordinate frame */
-  const geometry_msgs::Pose& center = ps[(max_idx + 2) % 3];
-  T.setOrigin(tf::Vector3(center.position.x, center.position.y, 0.0));
-
-  /* compute robot orientation as orientation of coordinate frame */
-  const geometry_msgs::Pose& p1 = ps[(max_idx + 0) % 3];
-  const geometry_msgs::Pose& p2 = ps[(max_idx + 1) % 3];
-
-  float v1[2], v2[2];
-  v1[0] = p1.position.x - center.position.x; v1[1] = p1.position.y - center.position.y;
-  v2[0] = p2.position.x - center.position.x; v2[1] = p2.position.y - center.position.y;
+  std::vector<tf::Point> points(ps.size());
+  for (size_t i = 0; i < ps.size(); i++)
+    tf::pointMsgToTF(ps[i].position, points[i]);
 
-  float n1 = sqrt(v1[0] * v1[0] + v1[1] * v1[1]);
-  float n2 = sqrt(v2[0] * v2[0] + v2[1] * v2[1]);
+  tf::Transform T;
+  if (estimate_pose(points, T) == 0) { ROS_WARN_THROTTLE(1, "Marker layout not found among %zu circles, will not compute pose", points.size()); return; }
 
-  v1[0] /= n1; v1[1] /= n1;
-  v2[0] /= n2; v2[1] /= n2;
+  broadcaster->sendTransform(tf::StampedTransform(T, pose_array->header.stamp, world_frame, target_frame));
+}
 
-  if (angles::normalize_angle(atan2(v1[1], v1[0]) - atan2(v2[1], v2[0])) > 0)
-    T.setRotation(tf::createQuaternionFromYaw(atan2(v2[1], v2[0])));
-  else
-    T.setRotation(tf::createQuaternionFromYaw(atan2(v1[1], v1[0])));
+/* hypotheses are built from triplets of detections whose pairwise distances match a triplet of the layout,
+ * the one explaining most detections (and with the smallest error among those) is refined on all of them */
+int whycon::RobotPosePublisher::estimate_pose(const std::vector<tf::Point>& points, tf::Transform& T) const
+{
+  size_t n = points.size(), m = layout.size();
+  if (n < 3) return 0;
+
+  std::vector<std::vector<double> > dists(n, std::vector<double>(n));
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      dists[i][j] = points[i].distance(points[j]);
+
+  int best_inliers = 0;
+  double best_error = std::numeric_limits<double>::max();
+  std::vector<int> best_matches, matches;
+  std::vector<tf::Point> from(3), to(3);
+
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = i + 1; j < n; j++) {
+      for (size_t a = 0; a < m; a++) {
+        for (size_t b = 0; b < m; b++) {
+          if (a == b || fabs(dists[i][j] - layout_dists[a][b]) > axis_length_tolerance) continue;
+
+          for (size_t k = 0; k < n; k++) {
+            if (k == i || k == j) continue;
+            for (size_t c = 0; c < m; c++) {
+              if (c == a || c == b) continue;
+              if (fabs(dists[i][k] - layout_dists[a][c]) > axis_length_tolerance) continue;
+              if (fabs(dists[j][k] - layout_dists[b][c]) > axis_length_tolerance) continue;
+
+              /* collinear triplets do not define a rotation */
+              tf::Vector3 normal = (layout[b] - layout[a]).cross(layout[c] - layout[a]);
+              if (normal.length() < axis_length_tolerance * layout_dists[a][b]) continue;
+
+              from[0] = layout[a]; from[1] = layout[b]; from[2] = layout[c];
+              to[0] = points[i]; to[1] = points[j]; to[2] = points[k];
+
+              tf::Transform hypothesis;
+              if (!fit_transform(from, to, hypothesis)) continue;
+
+              /* planar layouts also fit upside down with swapped correspondences, the robot is assumed upright */
+              if (hypothesis.getBasis()[2][2] < 0) continue;
+
+              double error;
+              int inliers = count_inliers(points, hypothesis, matches, error);
+              if (inliers > best_inliers || (inliers == best_inliers && error < best_error)) {
+                best_inliers = inliers;
+                best_error = error;
+                best_matches = matches;
+                T = hypothesis;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (best_inliers < 3) return 0;
+
+  /* least-squares fit on all matched circles */
+  from.clear(); to.clear();
+  for (size_t a = 0; a < m; a++) {
+    if (best_matches[a] < 0) continue;
+    from.push_back(layout[a]);
+    to.push_back(points[best_matches[a]]);
+  }
+  fit_transform(from, to, T);
+
+  return best_inliers;
+}
 
-  broadcaster->sendTransform(tf::StampedTransform(T, pose_array->header.stamp, world_frame, target_frame));
+/* rigid transform minimizing the squared distances between T * from and to (Kabsch) */
+bool whycon::RobotPosePublisher::fit_transform(const std::vector<tf::Point>& from, const std::vector<tf::Point>& to, tf::Transform& T)
+{
+  size_t n = from.size();
+  tf::Vector3 from_mean(0, 0, 0), to_mean(0, 0, 0);
+  for (size_t i = 0; i < n; i++) { from_mean += from[i]; to_mean += to[i]; }
+  from_mean /= n; to_mean /= n;
+
+  cv::Matx33d H = cv::Matx33d::zeros();
+  for (size_t i = 0; i < n; i++) {
+    tf::Vector3 p = from[i] - from_mean, q = to[i] - to_mean;
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 3; c++)
+        H(r, c) += p[r] * q[c];
+  }
+
+  cv::Matx31d w;
+  cv::Matx33d u, vt;
+  cv::SVD::compute(H, w, u, vt);
+  if (w(1) < 1e-9) return false; // degenerate
+
+  /* correct for a reflection, so that R is a proper rotation */
+  cv::Matx33d D = cv::Matx33d::eye();
+  D(2, 2) = (cv::determinant(vt.t() * u.t()) < 0 ? -1 : 1);
+  cv::Matx33d R = vt.t() * D * u.t();
+
+  tf::Matrix3x3 basis(R(0, 0), R(0, 1), R(0, 2),
+                      R(1, 0), R(1, 1), R(1, 2),
+                      R(2, 0), R(2, 1), R(2, 2));
+  T.setBasis(basis);
+  T.setOrigin(to_mean - basis * from_mean);
+  return true;
 }
 
+/* every layout circle is matched to the closest unused detection within the tolerance */
+int whycon::RobotPosePublisher::count_inliers(const std::vector<tf::Point>& points, const tf::Transform& T,
+                                              std::vector<int>& matches, double& error) const
+{
+  std::vector<bool> used(points.size(), false);
+  matches.assign(layout.size(), -1);
+  error = 0;
+  int inliers = 0;
+
+  for (size_t a = 0; a < layout.size(); a++) {
+    tf::Point p = T * layout[a];
+    double min_dist = axis_length_tolerance;
+    for (size_t i = 0; i < points.size(); i++) {
+      double dist = p.distance(points[i]);
+      if (!used[i] && dist < min_dist) { min_dist = dist; matches[a] = i; }
+    }
+
+    if (matches[a] >= 0) {
+      used[matches[a]] = true;
+      error += min_dist * min_dist;
+      inliers++;
+    }
+  }
+
+  if (inliers > 0) error /= inliers;
+  return inliers;
+}
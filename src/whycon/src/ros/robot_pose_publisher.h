@@ -17,6 +17,19 @@ namespace whycon {
       double axis_length_tolerance;
       std::string world_frame, target_frame, axis_file;
       void on_poses(const geometry_msgs::PoseArrayConstPtr& pose_array);
+
+      /* Finds the pose of the marker layout among the detected points, which may contain clutter
+       * and miss some of the layout circles. Returns the number of matched circles, 0 if no pose was found. */
+      int estimate_pose(const std::vector<tf::Point>& points, tf::Transform& T) const;
+
+    private:
+      /* Circle positions in the robot frame, at least three non-collinear ones */
+      std::vector<tf::Point> layout;
+      std::vector<std::vector<double> > layout_dists;
+
+      static bool fit_transform(const std::vector<tf::Point>& from, const std::vector<tf::Point>& to, tf::Transform& T);
+      int count_inliers(const std::vector<tf::Point>& points, const tf::Transform& T,
+                        std::vector<int>& matches, double& error) const;
   };
 }
 
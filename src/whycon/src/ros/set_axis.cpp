@@ -27,6 +27,7 @@ namespace std {
 whycon::AxisSetter::AxisSetter(ros::NodeHandle &n)
 {
 	transforms_set = false;
+	rejections = 0;
 
 	if (!n.getParam("xscale", xscale) || !n.getParam("yscale", yscale)) throw std::runtime_error("Please specify xscale and yscale");
 
@@ -35,6 +36,11 @@ whycon::AxisSetter::AxisSetter(ros::NodeHandle &n)
 		if (axis_order.size() != 4) throw std::runtime_error("Exactly four indices are needed for specifying axis");
 	}
 
+	n.param("window_size", window_size, 30);
+	n.param("max_inconsistency", max_inconsistency, 0.1);
+	n.param("max_rejections", max_rejections, window_size);
+	if (window_size < 1) throw std::runtime_error("window_size should be at least one frame");
+
 	poses_sub = n.subscribe("/whycon/poses", 1, &AxisSetter::on_poses, this);
 	image_sub = n.subscribe("/camera/image_rect_color", 1, &AxisSetter::on_image, this);
 	image_pub = n.advertise<sensor_msgs::Image>("image", 1);
@@ -71,7 +77,7 @@ void whycon::AxisSetter::detect_square(std::vector<tf::Point>& points)
 	points[2] = points_original[axis2_i];
 	points[3] = points_original[xy_i];
 
-	ROS_INFO_STREAM("Axis: (0,0) -> 0, (1,0) -> " << axis1_i << ", (0,1) -> " << axis2_i << ", (1,1) -> " << xy_i);
+	ROS_DEBUG_STREAM("Axis: (0,0) -> 0, (1,0) -> " << axis1_i << ", (0,1) -> " << axis2_i << ", (1,1) -> " << xy_i);
 }
 
 void whycon::AxisSetter::build_square(std::vector<tf::Point>& points)
@@ -81,17 +87,69 @@ void whycon::AxisSetter::build_square(std::vector<tf::Point>& points)
 	for (int i = 0; i < 4; i++)
 		points[i] = points_original[axis_order[i]];
 
-	ROS_INFO_STREAM("Axis: (0,0) -> " << axis_order[0] << ", (1,0) -> " << axis_order[1] << ", (0,1) -> " << axis_order[2] << ", (1,1) -> " << axis_order[3]);
+	ROS_DEBUG_STREAM("Axis: (0,0) -> " << axis_order[0] << ", (1,0) -> " << axis_order[1] << ", (0,1) -> " << axis_order[2] << ", (1,1) -> " << axis_order[3]);
+}
+
+/**
+ * Checks that the ordered points form a rectangle and match the mean of the previously accumulated frames
+ */
+bool whycon::AxisSetter::is_consistent(const std::vector<tf::Point>& points)
+{
+	tf::Vector3 x_axis = points[1] - points[0];
+	tf::Vector3 y_axis = points[2] - points[0];
+	double size = std::max(x_axis.length(), y_axis.length());
+
+	if ((points[3] - points[0] - x_axis - y_axis).length() > max_inconsistency * size) {
+		ROS_WARN_STREAM_THROTTLE(1, "Rejecting frame, the four circles do not form a parallelogram");
+		return false;
+	}
+
+	if (fabs(x_axis.normalized().dot(y_axis.normalized())) > max_inconsistency) {
+		ROS_WARN_STREAM_THROTTLE(1, "Rejecting frame, the axes are not perpendicular");
+		return false;
+	}
+
+	if (!frames.empty()) {
+		for (int i = 0; i < 4; i++) {
+			if ((points[i] - frames_sum[i] / frames.size()).length() > max_inconsistency * size) {
+				ROS_WARN_STREAM_THROTTLE(1, "Rejecting frame, circles moved or were ordered differently than in the previous frames");
+
+				/* the accumulated frames may be the outliers, e.g. if the first one was, so start over */
+				if (++rejections >= max_rejections) {
+					ROS_WARN_STREAM("Restarting accumulation after " << rejections << " consecutive rejected frames");
+					frames.clear();
+					rejections = 0;
+				}
+				return false;
+			}
+		}
+	}
+
+	rejections = 0;
+	return true;
 }
 
-tf::Matrix3x3 whycon::AxisSetter::compute_projection(const std::vector<tf::Point>& points, float xscale, float yscale)
+tf::Matrix3x3 whycon::AxisSetter::compute_projection(const std::vector< std::vector<tf::Point> >& frames, float xscale, float yscale, double& residual)
 {
 	/* TODO: use only ROS/Eigen for this */
-  std::vector<cv::Vec2d> src(4);
-  for (int i = 0; i < 4; i++) src[i] = cv::Vec2d(points[i].getX(), points[i].getY()) / points[i].getZ();
-	std::vector<cv::Vec2d> dest = { cv::Vec2d(0,0), cv::Vec2d(xscale, 0), cv::Vec2d(0, yscale), cv::Vec2d(xscale, yscale) };
+	cv::Vec2d square[4] = { cv::Vec2d(0,0), cv::Vec2d(xscale, 0), cv::Vec2d(0, yscale), cv::Vec2d(xscale, yscale) };
+	std::vector<cv::Vec2d> src, dest;
+	for (size_t f = 0; f < frames.size(); f++) {
+		for (int i = 0; i < 4; i++) {
+			src.push_back(cv::Vec2d(frames[f][i].getX(), frames[f][i].getY()) / frames[f][i].getZ());
+			dest.push_back(square[i]);
+		}
+	}
 
-	cv::Matx33d projection = cv::findHomography(src, dest, CV_LMEDS);
+	/* least-squares over all accumulated points, inconsistent frames were already rejected */
+	cv::Matx33d projection = cv::findHomography(src, dest, 0);
+
+	residual = 0;
+	for (size_t i = 0; i < src.size(); i++) {
+		cv::Vec3d p = projection * cv::Vec3d(src[i](0), src[i](1), 1);
+		residual += pow(p(0) / p(2) - dest[i](0), 2) + pow(p(1) / p(2) - dest[i](1), 2);
+	}
+	residual = sqrt(residual / src.size());
 
 	tf::Matrix3x3 m;
 	for (int i = 0; i < 3; i++)
@@ -101,46 +159,66 @@ tf::Matrix3x3 whycon::AxisSetter::compute_projection(const std::vector<tf::Point
 	return m;
 }
 
-tf::Transform whycon::AxisSetter::compute_similarity(const std::vector<tf::Point>& points)
+/**
+ * Rigid transform bringing the circles onto a rectangle with origin at (0,0), X along (1,0) and Y along (0,1),
+ * with side lengths as measured by the localizer. Solved in the least-squares sense over all frames (Kabsch).
+ */
+tf::Transform whycon::AxisSetter::compute_similarity(const std::vector< std::vector<tf::Point> >& frames, double& residual)
 {
+	double x_length = 0, y_length = 0;
+	for (size_t f = 0; f < frames.size(); f++) {
+		x_length += (frames[f][1] - frames[f][0]).length() + (frames[f][3] - frames[f][2]).length();
+		y_length += (frames[f][2] - frames[f][0]).length() + (frames[f][3] - frames[f][1]).length();
+	}
+	x_length /= 2 * frames.size();
+	y_length /= 2 * frames.size();
+
+	tf::Point square[4] = { tf::Point(0, 0, 0), tf::Point(x_length, 0, 0), tf::Point(0, y_length, 0), tf::Point(x_length, y_length, 0) };
+	tf::Point square_mean(x_length / 2, y_length / 2, 0);
+
+	tf::Point mean(0, 0, 0);
+	for (size_t f = 0; f < frames.size(); f++)
+		for (int i = 0; i < 4; i++)
+			mean += frames[f][i];
+	mean /= 4 * frames.size();
+
+	cv::Matx33d H = cv::Matx33d::zeros();
+	for (size_t f = 0; f < frames.size(); f++) {
+		for (int i = 0; i < 4; i++) {
+			tf::Vector3 p = frames[f][i] - mean, q = square[i] - square_mean;
+			for (int r = 0; r < 3; r++)
+				for (int c = 0; c < 3; c++)
+					H(r, c) += p[r] * q[c];
+		}
+	}
 
-	tf::Point vectors[3];
-	vectors[0] = points[1] - points[0];
-	vectors[1] = points[2] - points[0];
-	vectors[2] = vectors[0].cross(vectors[1]);
-
-	for (int i = 0; i < 3; i++) vectors[i].normalize();
-
-	tf::Matrix3x3 rotation;
-	for (int i = 0; i < 3; i++)
-		for (int j = 0;	j < 3; j++)
-			rotation[j][i] = vectors[i][j];
+	cv::Matx31d w;
+	cv::Matx33d u, vt;
+	cv::SVD::compute(H, w, u, vt);
 
-	tf::Quaternion Q;
-	rotation.getRotation(Q);
+	/* correct for a reflection, so that the result is a proper rotation */
+	cv::Matx33d D = cv::Matx33d::eye();
+	D(2, 2) = (cv::determinant(vt.t() * u.t()) < 0 ? -1 : 1);
+	cv::Matx33d R = vt.t() * D * u.t();
 
-	tf::Transform rot_transform;
-	rot_transform.setRotation(Q);
+	tf::Matrix3x3 rotation(R(0, 0), R(0, 1), R(0, 2),
+	                       R(1, 0), R(1, 1), R(1, 2),
+	                       R(2, 0), R(2, 1), R(2, 2));
 
 	tf::Transform similarity;
-	similarity.setOrigin(rot_transform.inverse() * -points[0]);
-	similarity.setRotation(Q.inverse());
-
-	ROS_INFO_STREAM("transformed origin -> " << similarity * points[0]);
-	ROS_INFO_STREAM("transformed circle along X -> " << similarity * points[1]);
-	ROS_INFO_STREAM("transformed circle along Y -> " << similarity * points[2]);
-	ROS_INFO_STREAM("transformed circle along XY -> " << similarity * points[3]);
+	similarity.setBasis(rotation);
+	similarity.setOrigin(square_mean - rotation * mean);
 
-	/*float original_x = (points[1] - points[0]).length();
-	float original_y = (points[2] - points[0]).length();
-	float x = (similarity * points[1] - similarity * points[0]).length();
-	float y = (similarity * points[2] - similarity * points[0]).length();
-	float scaling_x = xscale / x;
-	float scaling_y = yscale / y;
+	residual = 0;
+	for (size_t f = 0; f < frames.size(); f++)
+		for (int i = 0; i < 4; i++)
+			residual += (similarity * frames[f][i] - square[i]).length2();
+	residual = sqrt(residual / (4 * frames.size()));
 
-	float xy = (scaling_x * (similarity * points[3]) - scaling_y * (similarity * points[0])).length();
-	ROS_INFO_STREAM("original X " << original_x << " original Y " << original_y << " norm X " << x << " norm Y " << y);
-	ROS_INFO_STREAM("obtained XY scale: " << xy << " expected: " << sqrt(xscale * xscale + yscale * yscale) << " scaling: " << scaling_x << " " << scaling_y);*/
+	ROS_INFO_STREAM("transformed origin -> " << similarity * frames.back()[0]);
+	ROS_INFO_STREAM("transformed circle along X -> " << similarity * frames.back()[1]);
+	ROS_INFO_STREAM("transformed circle along Y -> " << similarity * frames.back()[2]);
+	ROS_INFO_STREAM("transformed circle along XY -> " << similarity * frames.back()[3]);
 
 	return similarity;
 }
@@ -182,7 +260,7 @@ void whycon::AxisSetter::on_poses(const geometry_msgs::PoseArrayConstPtr& poses_
 	if (transforms_set) return;
 
 	if (poses_msg->poses.size() < 4) {
-		ROS_WARN_STREAM("Not computing, only " << poses_msg->poses.size() << " targets detected, need four.");
+		ROS_WARN_STREAM_THROTTLE(1, "Not computing, only " << poses_msg->poses.size() << " targets detected, need four.");
 		return;
 	}
 
@@ -195,13 +273,25 @@ void whycon::AxisSetter::on_poses(const geometry_msgs::PoseArrayConstPtr& poses_
 	else
 		build_square(points);
 
-	tf::Matrix3x3 projection = compute_projection(points, xscale, yscale);
-	tf::Transform similarity = compute_similarity(points);
+	if (!is_consistent(points)) return;
+
+	if (frames.empty()) frames_sum.assign(4, tf::Point(0, 0, 0));
+	for (int i = 0; i < 4; i++)
+		frames_sum[i] += points[i];
+	frames.push_back(points);
+	ROS_INFO_STREAM_THROTTLE(1, "Accumulated " << frames.size() << "/" << window_size << " frames");
+	if ((int)frames.size() < window_size) return;
+
+	double projection_residual, similarity_residual;
+	tf::Matrix3x3 projection = compute_projection(frames, xscale, yscale, projection_residual);
+	tf::Transform similarity = compute_similarity(frames, similarity_residual);
 
-	ROS_INFO_STREAM("Computed Transformations for \"" << poses_msg->header.frame_id << "\" localizer");
+	ROS_INFO_STREAM("Computed Transformations for \"" << poses_msg->header.frame_id << "\" localizer over " << frames.size() << " frames");
 	ROS_INFO_STREAM("Projection:" << projection);
+	ROS_INFO_STREAM("Projection RMS residual: " << projection_residual);
 	ROS_INFO_STREAM("Similarity Translation:" << similarity.getOrigin());
 	ROS_INFO_STREAM("Similarity Rotation:" << similarity.getBasis());
+	ROS_INFO_STREAM("Similarity RMS residual: " << similarity_residual);
 
 	YAML::Emitter yaml;
 	yaml << YAML::BeginMap;
@@ -23,14 +23,27 @@ namespace whycon {
 
 			std::vector<int> axis_order;
 
+			/* number of consistent frames accumulated before computing the transforms */
+			int window_size;
+			/* tolerated deviation of a frame from the expected rectangle, relative to its size */
+			double max_inconsistency;
+			/* consecutive frames disagreeing with the accumulated ones after which the window is restarted */
+			int max_rejections;
+
 		private:
 			void detect_square(std::vector<tf::Point>& points);
-			tf::Matrix3x3 compute_projection(const std::vector<tf::Point>& points, float xscale, float yscale);
-			tf::Transform compute_similarity(const std::vector<tf::Point>& points);
+			bool is_consistent(const std::vector<tf::Point>& points);
+			tf::Matrix3x3 compute_projection(const std::vector< std::vector<tf::Point> >& frames, float xscale, float yscale, double& residual);
+			tf::Transform compute_similarity(const std::vector< std::vector<tf::Point> >& frames, double& residual);
 
 			void write_projection(YAML::Emitter& yaml, const tf::Matrix3x3& projection);
 			void write_similarity(YAML::Emitter& yaml, const tf::Transform& similarity);
 			void build_square(std::vector<tf::Point>& points);
+
+			std::vector< std::vector<tf::Point> > frames;
+			/* sum of the accumulated frames, for their running mean */
+			std::vector<tf::Point> frames_sum;
+			int rejections;
 	};
 }
 
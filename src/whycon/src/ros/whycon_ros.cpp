@@ -6,12 +6,20 @@
 #include <geometry_msgs/PoseArray.h>
 #include <yaml-cpp/yaml.h>
 #include <whycon/Projection.h>
+#include <whycon/MarkerStamps.h>
+#include <whycon/MarkerIds.h>
 #include "whycon_ros.h"
+#include "allocation_counter.h"
 
 whycon::WhyConROS::WhyConROS(ros::NodeHandle& n) : is_tracking(false), should_reset(true), it(n)
 {
 	transformation_loaded = false;
 	similarity.setIdentity();
+	reacquisitions = reacquire_frames = max_reacquire_frames = 0;
+
+  #if defined(ENABLE_ALLOCATION_COUNTER) && !defined(COUNT_ALLOCATIONS)
+  ROS_WARN("Heap allocations are only counted in the whycon node, not in the nodelet");
+  #endif
 
   if (!n.getParam("targets", targets)) throw std::runtime_error("Private parameter \"targets\" is missing");
 
@@ -28,8 +36,20 @@ whycon::WhyConROS::WhyConROS(ros::NodeHandle& n) : is_tracking(false), should_re
 	n.getParam("circularity_tolerance", parameters.circularity_tolerance);
 	n.getParam("max_size", parameters.max_size);
 	n.getParam("min_size", parameters.min_size);
+	n.getParam("max_apparent_diameter", parameters.max_apparent_diameter);
+	n.getParam("min_distance", parameters.min_distance);
 	n.getParam("ratio_tolerance", parameters.ratio_tolerance);
 	n.getParam("max_eccentricity", parameters.max_eccentricity);
+	n.getParam("id_bits", parameters.id_bits);
+	n.getParam("id_sampling_ratio", parameters.id_sampling_ratio);
+
+	n.param("line_readout_time", line_readout_time, 0.0);
+	std::string imu_topic;
+	n.param("imu_topic", imu_topic, std::string());
+	if (line_readout_time > 0 && !imu_topic.empty()) {
+		transform_listener = boost::make_shared<tf::TransformListener>();
+		imu_sub = n.subscribe(imu_topic, 10, &WhyConROS::on_imu, this);
+	}
 
 	load_transforms();
 	transform_broadcaster = boost::make_shared<tf::TransformBroadcaster>();
@@ -43,6 +63,8 @@ whycon::WhyConROS::WhyConROS(ros::NodeHandle& n) : is_tracking(false), should_re
   poses_pub = n.advertise<geometry_msgs::PoseArray>("poses", 1);
   context_pub = n.advertise<sensor_msgs::Image>("context", 1);
 	projection_pub = n.advertise<whycon::Projection>("projection", 1);
+	if (line_readout_time > 0) stamps_pub = n.advertise<whycon::MarkerStamps>("stamps", 1);
+	if (parameters.id_bits > 0) ids_pub = n.advertise<whycon::MarkerIds>("ids", 1);
 
   reset_service = n.advertiseService("reset", &WhyConROS::reset, this);
 }
@@ -59,9 +81,17 @@ void whycon::WhyConROS::on_image(const sensor_msgs::ImageConstPtr& image_msg, co
     system = boost::make_shared<whycon::LocalizationSystem>(targets, image.size().width, image.size().height, cv::Mat(camera_model.fullIntrinsicMatrix()), cv::Mat(camera_model.distortionCoeffs()), parameters);
 
   is_tracking = system->localize(image, should_reset/*!is_tracking*/, max_attempts, max_refine);
+  update_reacquisition_stats();
 
   if (is_tracking) {
+    #if defined(COUNT_ALLOCATIONS)
+    size_t allocations = whycon::allocation_count();
+    #endif
     publish_results(image_msg->header, cv_ptr);
+    #if defined(COUNT_ALLOCATIONS)
+    allocations = whycon::allocation_count() - allocations;
+    ROS_INFO_STREAM_THROTTLE(1, "heap allocations while publishing results: " << allocations);
+    #endif
     should_reset = false;
   }
   else if (image_pub.getNumSubscribers() != 0)
@@ -76,6 +106,59 @@ void whycon::WhyConROS::on_image(const sensor_msgs::ImageConstPtr& image_msg, co
   }
 }
 
+void whycon::WhyConROS::update_reacquisition_stats(void)
+{
+  lost_frames.resize(system->targets, -1);
+
+  for (int i = 0; i < system->targets; i++) {
+    if (!system->get_circle(i).valid) {
+      if (lost_frames[i] >= 0) lost_frames[i]++;
+      continue;
+    }
+    if (lost_frames[i] > 0) {
+      reacquisitions++;
+      reacquire_frames += lost_frames[i];
+      max_reacquire_frames = std::max(max_reacquire_frames, lost_frames[i]);
+    }
+    lost_frames[i] = 0;
+  }
+
+  if (reacquisitions > 0)
+    ROS_INFO_STREAM_THROTTLE(10, "targets reacquired " << reacquisitions << " times, frames to reacquire (mean/max): "
+                             << (double)reacquire_frames / reacquisitions << " " << max_reacquire_frames);
+}
+
+void whycon::WhyConROS::on_imu(const sensor_msgs::ImuConstPtr& imu_msg)
+{
+	boost::mutex::scoped_lock lock(imu_mutex);
+	last_imu = imu_msg;
+}
+
+/* camera rotation during the readout of one row, from the latest angular velocity measured by the IMU */
+cv::Vec3d whycon::WhyConROS::get_row_rotation(const std_msgs::Header& header)
+{
+	sensor_msgs::ImuConstPtr imu;
+	{
+		boost::mutex::scoped_lock lock(imu_mutex);
+		imu = last_imu;
+	}
+	if (!imu || fabs((header.stamp - imu->header.stamp).toSec()) > IMU_TIMEOUT) return cv::Vec3d(0, 0, 0);
+
+	tf::StampedTransform imu_to_camera;
+	try {
+		transform_listener->lookupTransform(header.frame_id, imu->header.frame_id, ros::Time(0), imu_to_camera);
+	}
+	catch (const tf::TransformException& ex) {
+		ROS_WARN_STREAM_THROTTLE(1, "Not compensating rolling shutter rotation: " << ex.what());
+		return cv::Vec3d(0, 0, 0);
+	}
+
+	tf::Vector3 angular_velocity;
+	tf::vector3MsgToTF(imu->angular_velocity, angular_velocity);
+	tf::Vector3 rotation = imu_to_camera.getBasis() * angular_velocity * line_readout_time;
+	return cv::Vec3d(rotation.x(), rotation.y(), rotation.z());
+}
+
 bool whycon::WhyConROS::reset(std_srvs::Empty::Request& request, std_srvs::Empty::Response& response)
 {
   should_reset = true;
@@ -86,20 +169,47 @@ void whycon::WhyConROS::publish_results(const std_msgs::Header& header, const cv
 {
   bool publish_images = (image_pub.getNumSubscribers() != 0);
   bool publish_poses = (poses_pub.getNumSubscribers() != 0);
+  bool publish_stamps = (line_readout_time > 0 && stamps_pub.getNumSubscribers() != 0);
+  bool publish_ids = (parameters.id_bits > 0 && ids_pub.getNumSubscribers() != 0);
   
-  if (!publish_images && !publish_poses) return;
+  if (!publish_images && !publish_poses && !publish_stamps && !publish_ids) return;
+
+  cv::Vec3d row_rotation(0, 0, 0);
+  if (transform_listener) row_rotation = get_row_rotation(header);
   
-  // prepare image outpu
+  // prepare image output, drawing directly into the message buffer
   cv::Mat output_image;
-  if (publish_images)
-    output_image = cv_ptr->image.clone();
+  if (publish_images) {
+    const cv::Mat& image = cv_ptr->image;
+    reuse(output_image_msg);
+    output_image_msg->header = cv_ptr->header;
+    output_image_msg->encoding = cv_ptr->encoding;
+    output_image_msg->height = image.rows;
+    output_image_msg->width = image.cols;
+    output_image_msg->is_bigendian = false;
+    output_image_msg->step = image.cols * image.elemSize();
+    output_image_msg->data.resize(output_image_msg->step * image.rows);
+    output_image = cv::Mat(image.rows, image.cols, image.type(), output_image_msg->data.data(), output_image_msg->step);
+    image.copyTo(output_image);
+  }
 
-  geometry_msgs::PoseArray pose_array;
+  if (publish_poses) {
+    reuse(pose_array_msg);
+    pose_array_msg->poses.resize(system->targets);
+  }
+  if (publish_stamps) {
+    reuse(stamps_msg);
+    stamps_msg->stamps.resize(system->targets);
+  }
+  if (publish_ids) {
+    reuse(ids_msg);
+    ids_msg->ids.resize(system->targets);
+  }
   
   // go through detected targets
   for (int i = 0; i < system->targets; i++) {
     const whycon::CircleDetector::Circle& circle = system->get_circle(i);
-    whycon::LocalizationSystem::Pose pose = system->get_pose(circle);
+    whycon::LocalizationSystem::Pose pose = system->get_pose(circle, row_rotation);
     cv::Vec3f coord = pose.pos;
 
     // draw each target
@@ -107,6 +217,7 @@ void whycon::WhyConROS::publish_results(const std_msgs::Header& header, const cv
       std::ostringstream ostr;
       ostr << std::fixed << std::setprecision(2);
 			ostr << coord << " " << i;
+			if (circle.id >= 0) ostr << " id " << circle.id;
       circle.draw(output_image, ostr.str(), cv::Vec3b(0,255,255));
 			/*whycon::CircleDetector::Circle new_circle = circle.improveEllipse(cv_ptr->image);
 			new_circle.draw(output_image, ostr.str(), cv::Vec3b(0,255,0));*/
@@ -114,34 +225,48 @@ void whycon::WhyConROS::publish_results(const std_msgs::Header& header, const cv
     }
 
     if (publish_poses) {
-      geometry_msgs::Pose p;
+      geometry_msgs::Pose& p = pose_array_msg->poses[i];
       p.position.x = pose.pos(0);
       p.position.y = pose.pos(1);
       p.position.z = pose.pos(2);
       p.orientation = tf::createQuaternionMsgFromRollPitchYaw(0, pose.rot(0), pose.rot(1));
-      pose_array.poses.push_back(p);
     }
-  }
 
-  if (publish_images) {
-    cv_bridge::CvImage output_image_bridge = *cv_ptr;
-    output_image_bridge.image = output_image;
-    image_pub.publish(output_image_bridge);
+    if (publish_stamps)
+      stamps_msg->stamps[i] = header.stamp + ros::Duration(circle.y * line_readout_time);
+
+    if (publish_ids)
+      ids_msg->ids[i] = circle.id;
   }
 
+  if (publish_images)
+    image_pub.publish(output_image_msg);
+
   if (publish_poses) {
-    pose_array.header = header;
-    pose_array.header.frame_id = frame_id;
-    poses_pub.publish(pose_array);
+    pose_array_msg->header = header;
+    pose_array_msg->header.frame_id = frame_id;
+    poses_pub.publish(pose_array_msg);
+  }
+
+  if (publish_stamps) {
+    stamps_msg->header = header;
+    stamps_msg->header.frame_id = frame_id;
+    stamps_pub.publish(stamps_msg);
+  }
+
+  if (publish_ids) {
+    ids_msg->header = header;
+    ids_msg->header.frame_id = frame_id;
+    ids_pub.publish(ids_msg);
   }
 
   if (transformation_loaded)
   {
 	transform_broadcaster->sendTransform(tf::StampedTransform(similarity, header.stamp, world_frame_id, frame_id));
 
-	whycon::Projection projection_msg;
-	projection_msg.header = header;
-	for (size_t i = 0; i < projection.size(); i++) projection_msg.projection[i] = projection[i];
+	reuse(projection_msg);
+	projection_msg->header = header;
+	for (size_t i = 0; i < projection.size(); i++) projection_msg->projection[i] = projection[i];
 	projection_pub.publish(projection_msg);
   } 
 }
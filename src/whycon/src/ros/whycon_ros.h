@@ -2,12 +2,19 @@
 #include <whycon/localization_system.h>
 #include <boost/shared_ptr.hpp>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/Imu.h>
+#include <geometry_msgs/PoseArray.h>
+#include <whycon/Projection.h>
+#include <whycon/MarkerStamps.h>
+#include <whycon/MarkerIds.h>
 #include <cv_bridge/cv_bridge.h>
 #include <image_transport/image_transport.h>
 #include <image_geometry/pinhole_camera_model.h>
 #include <std_srvs/Empty.h>
 #include <tf/tf.h>
 #include <tf/transform_broadcaster.h>
+#include <tf/transform_listener.h>
+#include <boost/thread/mutex.hpp>
 
 namespace whycon {
   class WhyConROS {
@@ -15,10 +22,12 @@ namespace whycon {
       WhyConROS(ros::NodeHandle& n);
 
       void on_image(const sensor_msgs::ImageConstPtr& image_msg, const sensor_msgs::CameraInfoConstPtr& info_msg);
+      void on_imu(const sensor_msgs::ImuConstPtr& imu_msg);
       bool reset(std_srvs::Empty::Request& request, std_srvs::Empty::Response& response);
 
     private:
 			void load_transforms(void);
+      cv::Vec3d get_row_rotation(const std_msgs::Header& header);
       void publish_results(const std_msgs::Header& header, const cv_bridge::CvImageConstPtr& cv_ptr);
       
 			whycon::DetectorParameters parameters;
@@ -36,11 +45,37 @@ namespace whycon {
       image_transport::CameraSubscriber cam_sub;
       ros::ServiceServer reset_service;
 
-      ros::Publisher image_pub, poses_pub, context_pub, projection_pub;
+      ros::Publisher image_pub, poses_pub, context_pub, projection_pub, stamps_pub, ids_pub;
 			boost::shared_ptr<tf::TransformBroadcaster>	transform_broadcaster;
 
       image_geometry::PinholeCameraModel camera_model;
 
       bool transformation_loaded;
+
+      /* time to reacquire lost targets: frames without detection since the last one of each target (-1 before the first) */
+      void update_reacquisition_stats(void);
+      std::vector<int> lost_frames;
+      int reacquisitions, reacquire_frames, max_reacquire_frames;
+
+      /* rolling shutter: time between the readout of two image rows (0 for global shutter cameras),
+       * the image stamp is assumed to be the time at which the first row was read */
+      double line_readout_time;
+      static constexpr double IMU_TIMEOUT = 0.1; // seconds
+
+      ros::Subscriber imu_sub;
+      sensor_msgs::ImuConstPtr last_imu;
+      boost::mutex imu_mutex;
+      boost::shared_ptr<tf::TransformListener> transform_listener;
+
+      /* published messages are reused in the next frame, unless a subscriber (e.g. an intra-process nodelet) still holds them */
+      template <class M> static void reuse(boost::shared_ptr<M>& msg) {
+        if (!msg || !msg.unique()) msg = boost::make_shared<M>();
+      }
+
+      sensor_msgs::ImagePtr output_image_msg;
+      geometry_msgs::PoseArrayPtr pose_array_msg;
+      whycon::MarkerStampsPtr stamps_msg;
+      whycon::MarkerIdsPtr ids_msg;
+      whycon::ProjectionPtr projection_msg;
   };
 }